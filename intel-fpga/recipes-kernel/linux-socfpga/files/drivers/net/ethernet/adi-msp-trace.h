@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/* Tracepoints of Analog Devices MS Plane Ethernet driver
+ *
+ * Copyright (C) 2022-2023 Analog Device Inc.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM adi_msp
+
+#if !defined(_ADI_MSP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ADI_MSP_TRACE_H
+
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/tracepoint.h>
+
+/* Latencies are in ns, 0 if latency_stats was off when the frame or the
+ * interrupt was stamped.
+ */
+
+TRACE_EVENT(adi_msp_xmit,
+	TP_PROTO(const struct net_device *dev, const struct sk_buff *skb),
+	TP_ARGS(dev, skb),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+		__field(u16, queue)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+		__entry->queue = skb_get_queue_mapping(skb);
+	),
+	TP_printk("dev=%s skbaddr=%p len=%u queue=%u",
+		  __get_str(name), __entry->skbaddr, __entry->len,
+		  __entry->queue)
+);
+
+TRACE_EVENT(adi_msp_tx_kick,
+	TP_PROTO(const struct net_device *dev, int head, int tail),
+	TP_ARGS(dev, head, tail),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(int, head)
+		__field(int, tail)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->head = head;
+		__entry->tail = tail;
+	),
+	TP_printk("dev=%s head=%d tail=%d",
+		  __get_str(name), __entry->head, __entry->tail)
+);
+
+TRACE_EVENT(adi_msp_tx_status,
+	TP_PROTO(const struct net_device *dev, const void *skbaddr, u8 tag,
+		 u64 xmit_to_kick, u64 kick_to_status),
+	TP_ARGS(dev, skbaddr, tag, xmit_to_kick, kick_to_status),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(const void *, skbaddr)
+		__field(u8, tag)
+		__field(u64, xmit_to_kick)
+		__field(u64, kick_to_status)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->skbaddr = skbaddr;
+		__entry->tag = tag;
+		__entry->xmit_to_kick = xmit_to_kick;
+		__entry->kick_to_status = kick_to_status;
+	),
+	TP_printk("dev=%s skbaddr=%p tag=%u xmit_to_kick=%llu kick_to_status=%llu",
+		  __get_str(name), __entry->skbaddr, __entry->tag,
+		  __entry->xmit_to_kick, __entry->kick_to_status)
+);
+
+TRACE_EVENT(adi_msp_rx_irq,
+	TP_PROTO(const struct net_device *dev),
+	TP_ARGS(dev),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+	),
+	TP_printk("dev=%s", __get_str(name))
+);
+
+TRACE_EVENT(adi_msp_rx_receive,
+	TP_PROTO(const struct net_device *dev, const struct sk_buff *skb,
+		 u64 irq_to_receive),
+	TP_ARGS(dev, skb, irq_to_receive),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+		__field(u64, irq_to_receive)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+		__entry->irq_to_receive = irq_to_receive;
+	),
+	TP_printk("dev=%s skbaddr=%p len=%u irq_to_receive=%llu",
+		  __get_str(name), __entry->skbaddr, __entry->len,
+		  __entry->irq_to_receive)
+);
+
+#endif /* _ADI_MSP_TRACE_H */
+
+/* The driver is built in drivers/net/ethernet without its own Makefile
+ * flags, so the path is relative to include/trace
+ */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/net/ethernet
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE adi-msp-trace
+#include <trace/define_trace.h>
@@ -9,11 +9,32 @@
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
+#include <net/ip.h>
+#include <net/page_pool.h>
+#include <net/xdp.h>
+#include <net/xdp_sock_drv.h>
+#include <net/busy_poll.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
 #include <linux/platform_device.h>
 #include <linux/ethtool.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/if_vlan.h>
 #include <linux/adi_phc.h>
+#include <linux/ptp_classify.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/dim.h>
+#include <linux/log2.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define CREATE_TRACE_POINTS
+#include "adi-msp-trace.h"
 
 #define DRV_NAME	"adi-msp"
 #define DRV_VERSION	"0.1"
@@ -59,13 +80,12 @@
  * 1. Because the start of IP header is always aligned to 4 bytes and the
  *    Ethernet header is 14 bytes. We need to add a workunit header of 2 or 6
  *    bytes to make the work unit aligned to 4 bytes.
- * 2. For SKBs using paged data, we want to use one following work unit for
- *    each fragment. But it's impossible to add a header for such work unit
+ * 2. For SKBs using paged data, we use one following DMA descriptor for
+ *    each fragment. It's impossible to add a header for such work unit
  *    without memory copy. Since we already provide the frame length in the
  *    header of the first work unit, we can tell the frame end by tracking
  *    how many bytes has been copied by DMA. So, we don't need a header for
  *    the work units following the first one.
- *    For now we are not going to support SKBs using paged data.
  */
 struct tx_wu_header {
 	u8 byte0;
@@ -94,8 +114,8 @@ struct status_wu_s {
  *   [15:0] : fractions of nanosecond (16 bits)
  * so in the following struct
  *   timestamp[0][7:0]  : byte0
- *   timestamp[0][16:8] : frame_tag
- *   timestamp[0][31:17]: fractions of nanosecond
+ *   timestamp[0][15:8] : frame_tag
+ *   timestamp[0][31:16]: fractions of nanosecond
  *   timestamp[1][31:0] : nanoseconds
  *   timestamp[2][31:0] : seconds[31:0]
  *   timestamp[3][15:0] : seconds[47:32]
@@ -176,6 +196,11 @@ struct dde_tester_regs {
 #define DMA_STAT_WAIT_FOR_TRIG	3 /* Wait for Trigger */
 #define DMA_STAT_WAIT_FOR_WACK	4 /* Wait for Write ACK/FIFO Drain to Peri */
 
+/* No stale DSCPTR_PREV, see adi_msp_dma_done_count(). Descriptors are
+ * 4-byte aligned, so it never matches a masked DSCPTR_PREV.
+ */
+#define ADI_MSP_DSCPTR_NONE	0xffffffff
+
 #define MSIZE01			0
 #define MSIZE02			1
 #define MSIZE04			2
@@ -263,37 +288,82 @@ struct dma_regs {
 	u32 bwmcnt_cur;         /* Bandwidth monitor count current */
 };
 
-/* the following must be powers of two */
-#define ADI_MSP_NUM_RDS		128  /* number of Rx descriptors */
-#define ADI_MSP_NUM_TDS		128  /* number of Tx/Status descriptors */
-#define ADI_MSP_NUM_SDS		ADI_MSP_NUM_TDS  /* number of Tx status descriptors */
-#define ADI_MSP_RDS_MASK	(ADI_MSP_NUM_RDS - 1)
-#define ADI_MSP_TDS_MASK	(ADI_MSP_NUM_TDS - 1)
-#define ADI_MSP_SDS_MASK	(ADI_MSP_NUM_SDS - 1)
-#define ADI_MSP_RD_RING_SIZE	(ADI_MSP_NUM_RDS * sizeof(struct dma_desc))
-#define ADI_MSP_TD_RING_SIZE	(ADI_MSP_NUM_TDS * sizeof(struct dma_desc))
-#define ADI_MSP_SD_RING_SIZE	(ADI_MSP_NUM_SDS * sizeof(struct dma_desc))
-
-#if ADI_MSP_NUM_TDS != ADI_MSP_NUM_SDS
-#error "Tx descriptors are not as many as Tx status descriptors"
-#endif
+/* Number of Rx and Tx descriptors, set by ethtool -G. They must be powers
+ * of two. There are as many Tx status descriptors as Tx descriptors.
+ */
+#define ADI_MSP_DEF_NUM_RDS	128
+#define ADI_MSP_DEF_NUM_TDS	128
+#define ADI_MSP_MIN_NUM_DS	64
+#define ADI_MSP_MAX_NUM_DS	4096
+#define ADI_MSP_NUM_SDS(lp)	((lp)->num_tds)
+#define ADI_MSP_RDS_MASK(lp)	((lp)->num_rds - 1)
+#define ADI_MSP_TDS_MASK(lp)	((lp)->num_tds - 1)
+#define ADI_MSP_SDS_MASK(lp)	(ADI_MSP_NUM_SDS(lp) - 1)
 
 /* Frame tag is an 8-bit field in work unit. It cannot be 0. So the number
  * of valid frame tags is 255.
  */
 #define ADI_MSP_NUM_FRAME_TAGS		255
-#define ADI_MSP_MIN_NONPTP_FRAME_TAG	1
-#define ADI_MSP_MAX_NONPTP_FRAME_TAG	247
-#define ADI_MSP_MIN_PTP_FRAME_TAG	(ADI_MSP_MAX_NONPTP_FRAME_TAG + 1)
-#define ADI_MSP_MAX_PTP_FRAME_TAG	ADI_MSP_NUM_FRAME_TAGS
+/* Bit 0 of the frame tag map is always set, so tag 0 is never used */
+#define ADI_MSP_FRAME_TAG_MAP_SIZE	(ADI_MSP_NUM_FRAME_TAGS + 1)
 
 /* TODO  try threshold other than 1 */
 #define ADI_MSP_STOP_QUEUE_TH	1
 
+/* PTP and non-PTP frames take frame tags from the same map. Each class can
+ * hold at most its share of them. The PTP share is set by module parameter
+ * ptp_frame_tags when the interface is opened.
+ */
+#define ADI_MSP_DEF_PTP_FRAME_TAGS	8
+#define ADI_MSP_MIN_CLASS_FRAME_TAGS	(ADI_MSP_STOP_QUEUE_TH + 1)
+
+/* A frame uses one Tx descriptor for the work unit header and the linear
+ * data, one for each page fragment and maybe one more for pads.
+ */
+#define ADI_MSP_TX_MAX_DESCS	(MAX_SKB_FRAGS + 2)
+
+/* Tx queues. PTP frames have their own queue, so they are not stopped or
+ * queued behind bulk traffic. Both queues feed the same Tx DMA ring. Each
+ * queue uses only its own class of frame tags.
+ */
+#define ADI_MSP_TXQ_NONPTP	0
+#define ADI_MSP_TXQ_PTP		1
+#define ADI_MSP_NUM_TXQS	2
+
+/* Tx descriptors which non-PTP queue cannot use. They are kept for PTP
+ * frames when bulk traffic fills the Tx ring.
+ */
+#define ADI_MSP_PTP_RESERVED_TDS	ADI_MSP_TX_MAX_DESCS
+
+/* E-tile ports behind MSP. Tx work units are steered by TX_WU_PORT_*, Rx
+ * status work units tell the port by RX_STAT_WU_HEADER_PORT.
+ */
+#define ADI_MSP_NUM_PORTS	2
+
 #define MTU			1500
+/* Jumbo frames are received into several data work units */
+#define MAX_MTU			9000
 
 #define TX_TIMEOUT_VALUE	0x100
 
+/* Limit of rx-usecs and tx-usecs. DMA done interrupt is kept masked that
+ * long after NAPI completes.
+ */
+#define ADI_MSP_MAX_COAL_USECS	1000
+
+/* Default and limit of stats-block-usecs. Hardware counters are collected
+ * that often in the background. The limit keeps 32-bit counters from
+ * wrapping more than once between two collections, and 0 is refused for
+ * the same reason.
+ */
+#define ADI_MSP_DEF_STATS_USECS	1000000
+#define ADI_MSP_MAX_STATS_USECS	10000000
+
+/* Latency histograms have log2 buckets of ns. Bucket 0 is [0, 2) ns, bucket
+ * N is [2^N, 2^(N+1)) ns, and the last one takes everything longer.
+ */
+#define ADI_MSP_LAT_BUCKETS	32
+
 /* If TX MAC does not do padding for us, we need to define this macro.
  * When this macro is define, the frame will be padded to at least 60 bytes.
  */
@@ -304,33 +374,67 @@ struct dma_regs {
 #define TX_MIN_FRAME_SIZE	9U
 #endif
 /* This includes optional 802.1Q tag */
-#define TX_MAX_FRAME_SIZE	(MTU + 18)
+#define TX_MAX_FRAME_SIZE(mtu)	((mtu) + 18)
+
+/* Pads of paged SKBs are transferred from a zeroed buffer of this size */
+#define TX_PAD_BUF_SIZE		round_up(TX_MIN_FRAME_SIZE + TX_WU_HEADER_LEN, 8)
 
 /* Minimal length of Ethernet frame header */
 #define RX_MIN_FRAME_SIZE	14
 /* This includes optional 802.1Q tag */
-#define RX_MAX_FRAME_SIZE	(MTU + 18)
+#define RX_MAX_FRAME_SIZE(mtu)	((mtu) + 18)
 
 #define RX_WU_LEN		1536
+/* Frame data carried by each data work unit. Only the last data work unit
+ * of a frame can carry less.
+ */
+#define RX_WU_DATA_LEN		(RX_WU_LEN - RX_DATA_WU_HEADER_LEN)
 
-/* The size of array prev_rx_skb[] */
-#define PREV_RX_SKB_NUM		6
+/* The size of array prev_rx_page[] */
+#define PREV_RX_PAGE_NUM	8
 /* How many data work units can be used for each frame.
- * Must be smaller than PREV_RX_SKB_NUM
+ * Must be smaller than PREV_RX_PAGE_NUM
  */
-#define DATA_WU_PER_FRAME	DIV_ROUND_UP(RX_MAX_FRAME_SIZE, RX_WU_LEN)
+#define DATA_WU_PER_FRAME	DIV_ROUND_UP(RX_MAX_FRAME_SIZE(MAX_MTU), \
+					     RX_WU_DATA_LEN)
 
-#if DATA_WU_PER_FRAME >= PREV_RX_SKB_NUM
-#error "PREV_RX_SKB_NUM should be larger than DATA_WU_PER_FRAME"
+#if DATA_WU_PER_FRAME >= PREV_RX_PAGE_NUM
+#error "PREV_RX_PAGE_NUM should be larger than DATA_WU_PER_FRAME"
 #endif
 
-#if DATA_WU_PER_FRAME > 1
-#error "Currently one Ethernet frame must fit into one data work unit"
+#if DATA_WU_PER_FRAME > MAX_SKB_FRAGS + 1
+#error "Data work units of a frame do not fit into one SKB"
 #endif
 
-/* This is used to assure Rx DMA buffers won't be adjacent to each other */
-#define RX_WU_GUARD_SIZE	1
-#define RX_WU_BUF_SIZE		(RX_WU_LEN + RX_WU_GUARD_SIZE)
+/* Each Rx work unit is received into a page from the page pool, after
+ * this headroom. So a data work unit can be turned into SKB by build_skb()
+ * without copying, and XDP programs can push headers or metadata in front
+ * of the frame. Pages also assure Rx DMA buffers won't be adjacent to each
+ * other.
+ */
+#define RX_WU_HEADROOM		XDP_PACKET_HEADROOM
+
+/* XDP programs only see frames received into one data work unit */
+#define XDP_MAX_MTU		(RX_WU_DATA_LEN - RX_MAX_FRAME_SIZE(0))
+
+/* Received frames shorter than this are copied into a new SKB of their own
+ * size, so the page goes back to the page pool at once. It can be changed
+ * by ethtool rx-copybreak tunable.
+ */
+#define RX_COPYBREAK_DEFAULT	256
+#define RX_COPYBREAK_MAX	RX_WU_DATA_LEN
+
+/* Frames shorter than ethtool tx-copybreak tunable are copied into a bounce
+ * buffer of the first Tx descriptor, together with work unit header and
+ * pads. Bounce buffers stay DMA mapped, so such frames are neither mapped
+ * nor expanded. Off by default.
+ */
+#define TX_BOUNCE_BUF_SIZE	256
+#define TX_COPYBREAK_MAX	(TX_BOUNCE_BUF_SIZE - TX_WU_HEADER_LEN)
+
+/* PTPv2 transports whose event messages are timestamped by Rx filter */
+#define ADI_MSP_PTP_L2		(1 << 0)
+#define ADI_MSP_PTP_L4		(1 << 1)
 
 /* This is used to assure Tx Status DMA buffers won't be adjacent to each other */
 #define STATUS_WU_GUARD_SIZE	1
@@ -470,12 +574,51 @@ enum chain_status {
 	ADI_MSP_STAT(rx_dropped_mplane, 0xc) \
 	ADI_MSP_STAT(rx_dropped_splane, 0x10)
 
+/* XDP verdicts on received frames, and frames sent by ndo_xdp_xmit and
+ * AF_XDP socket
+ */
+#define ADI_MSP_XDP_STATS \
+	ADI_MSP_XDP_STAT(rx_pass) \
+	ADI_MSP_XDP_STAT(rx_drop) \
+	ADI_MSP_XDP_STAT(rx_tx) \
+	ADI_MSP_XDP_STAT(rx_redirect) \
+	ADI_MSP_XDP_STAT(rx_aborted) \
+	ADI_MSP_XDP_STAT(xmit) \
+	ADI_MSP_XDP_STAT(xmit_errors) \
+	ADI_MSP_XDP_STAT(xsk_xmit)
+
+/* Tx resets done by adi_msp_tx_reset_work() and how long they took */
+#define ADI_MSP_TX_RESET_STATS \
+	ADI_MSP_TX_RESET_STAT(done) \
+	ADI_MSP_TX_RESET_STAT(last_usecs) \
+	ADI_MSP_TX_RESET_STAT(max_usecs)
+
 struct adi_msp_nl_stats {
 #define ADI_MSP_NL_STAT(S) u64 S;
 	ADI_MSP_NL_STATS
 #undef ADI_MSP_NL_STAT
 };
 
+/* Netlink counters of a port written by a single NAPI context, Rx or Tx
+ * status. They are added up into struct adi_msp_nl_stats on read, see
+ * adi_msp_get_nl_stats(). length_errors is only used by Rx.
+ */
+struct adi_msp_ctx_stats {
+	u64 packets;
+	u64 bytes;
+	u64 errors;
+	u64 dropped;
+	u64 length_errors;
+	struct u64_stats_sync syncp;
+};
+
+#define adi_msp_stats_inc(cs, S) \
+do { \
+	u64_stats_update_begin(&(cs)->syncp); \
+	(cs)->S++; \
+	u64_stats_update_end(&(cs)->syncp); \
+} while (0)
+
 struct intel_etile_tx_stats {
 #define INTEL_ETILE_STAT(S, OFFSET) u64 S;
 	INTEL_ETILE_TX_STATS
@@ -520,8 +663,22 @@ struct adi_msp_rx_stats {
 #undef ADI_MSP_STAT
 };
 
-struct adi_msp_stats {
-	struct adi_msp_nl_stats		nl;
+struct adi_msp_xdp_stats {
+#define ADI_MSP_XDP_STAT(S) u64 S;
+	ADI_MSP_XDP_STATS
+#undef ADI_MSP_XDP_STAT
+};
+
+struct adi_msp_tx_reset_stats {
+#define ADI_MSP_TX_RESET_STAT(S) u64 S;
+	ADI_MSP_TX_RESET_STATS
+#undef ADI_MSP_TX_RESET_STAT
+};
+
+/* Hardware counters. E-tile counters are 64-bit. The others are 32-bit and
+ * are accumulated into 64 bits by adi_msp_collect_hw_stats().
+ */
+struct adi_msp_hw_stats {
 	struct intel_etile_tx_stats	etile_tx;
 	struct intel_etile_rx_stats	etile_rx;
 	struct adi_bridge_mac_oif_stats	bridge_mac_oif;
@@ -533,6 +690,37 @@ struct adi_msp_stats {
 	struct adi_msp_rx_stats		msp_rx;
 };
 
+/* Latency of a stage of Tx or Rx path, written only by the NAPI of that
+ * path, even when it's cleared, see adi_msp_lat_sync(). It's read from
+ * debugfs without any synchronization, which is good enough for debugging.
+ */
+struct adi_msp_lat_hist {
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 bucket[ADI_MSP_LAT_BUCKETS];
+};
+
+enum adi_msp_tx_lat {
+	ADI_MSP_TX_LAT_XMIT_KICK,
+	ADI_MSP_TX_LAT_KICK_STATUS,
+	ADI_MSP_TX_LAT_XMIT_STATUS,
+	ADI_MSP_TX_LAT_NUM,
+};
+
+static const char * const adi_msp_tx_lat_names[ADI_MSP_TX_LAT_NUM] = {
+	[ADI_MSP_TX_LAT_XMIT_KICK] = "tx_xmit_to_kick",
+	[ADI_MSP_TX_LAT_KICK_STATUS] = "tx_kick_to_status",
+	[ADI_MSP_TX_LAT_XMIT_STATUS] = "tx_xmit_to_status",
+};
+
+struct adi_msp_stats {
+	struct adi_msp_nl_stats		nl;
+	struct adi_msp_hw_stats		hw;
+	struct adi_msp_xdp_stats	xdp;
+	struct adi_msp_tx_reset_stats	tx_reset;
+};
+
 struct oif_tx_regs {
 	u32 irq_event;		// 0x0
 	u32 irq_mask;		// 0x4
@@ -600,7 +788,68 @@ struct oif_rx_regs {
 	u32 cfg_ipv6_addr_3;	// 0x9c
 };
 
-/* Information that need to be kept for each board. */
+/* Seconds of the last converted timestamp, see get_timestamp_ns() */
+struct adi_msp_ts_cache {
+	u64 second;
+	u64 second_ns;
+};
+
+/* Per Tx descriptor state. Only the entry of the first descriptor of a
+ * frame holds the frame. It's touched for every frame, so keep it within
+ * 32 bytes, two entries per cache line. See adi_msp_alloc_ring_bufs().
+ */
+struct adi_msp_tx_buf {
+	struct sk_buff *skb;
+	/* Frames sent by XDP_TX or ndo_xdp_xmit, instead of skb */
+	struct xdp_frame *xdpf;
+	dma_addr_t dma;
+	u32 dma_len;
+	/* Number of Tx descriptors used by the frame starting here */
+	u8 descs;
+	/* Same as above, but only set when the frame is filled and not
+	 * linked into the Tx chain yet
+	 */
+	u8 pending;
+	/* Whether the frame starting here is in its bounce buffer */
+	bool bounced;
+	/* Frame from Tx ring of AF_XDP socket, which has neither skb nor
+	 * xdpf. Its work unit header is in the bounce buffer.
+	 */
+	bool xsk;
+};
+
+/* When the frame starting at the same index of tx_buf[] entered
+ * adi_msp_xmit() and when it was linked into the Tx chain. Kept apart from
+ * struct adi_msp_tx_buf, which is touched for every frame, and only
+ * allocated if latency_stats is set when the rings are. xmit is 0 if
+ * latency_stats was off when the frame was sent.
+ */
+struct adi_msp_tx_time {
+	ktime_t xmit;
+	ktime_t kick;
+};
+
+struct adi_msp_rx_buf {
+	union {
+		struct page *page;
+		/* Buffer from the fill ring of AF_XDP socket, if xsk is set */
+		struct xdp_buff *xdp;
+	};
+	/* DMA address of Rx work unit, i.e. after RX_WU_HEADROOM or
+	 * at xdp->data
+	 */
+	dma_addr_t dma;
+	bool xsk;
+};
+
+/* Information that need to be kept for each board.
+ *
+ * Fields written in the hot paths are grouped by the context writing them,
+ * each group starting on its own cache line: Tx producer (ndo_start_xmit
+ * and ndo_xdp_xmit), Tx accounting shared by Tx producer and Tx status
+ * NAPI, Tx status NAPI and Rx NAPI. The rest is set up at probe or open, or
+ * is only written in slow paths.
+ */
 struct adi_msp_private {
 	struct msp_rx_regs __iomem *rx_regs;
 	struct msp_tx_regs __iomem *tx_regs;
@@ -614,6 +863,9 @@ struct adi_msp_private {
 	void __iomem *bridge_tx_regs;
 	void __iomem *bridge_rx_regs;
 	void __iomem *etile_regs;
+	/* Optional, NULL if the block cannot be reset */
+	void __iomem *rst_ctrl;
+	u32 rst_ctrl_tx;
 #ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
 	void __iomem *async_fifo_rx_regs;
 #endif
@@ -625,175 +877,382 @@ struct adi_msp_private {
 	dma_addr_t rd_dma;
 	dma_addr_t sd_dma;
 
-	struct sk_buff *tx_skb[ADI_MSP_NUM_TDS];
-	struct sk_buff *rx_skb[ADI_MSP_NUM_RDS];
+	/* Ring sizes, only changed when the interface is down */
+	u32 num_rds;
+	u32 num_tds;
+
+	/* The following are allocated with the rings */
+	struct adi_msp_tx_buf *tx_buf;
+	struct adi_msp_rx_buf *rx_buf;
+	struct adi_msp_tx_time *tx_time;
 	u8 *status_wu;
+	u8 *tx_bounce;
+	dma_addr_t status_wu_dma;
+	dma_addr_t tx_bounce_dma;
 
-	u8 next_nonptp_frame_tag;
-	u8 last_nonptp_frame_tag;
-	atomic_t available_nonptp_frame_tag_count;
+	u8 *tx_pad;
+	dma_addr_t tx_pad_dma;
 
-	u8 next_ptp_frame_tag;
-	u8 last_ptp_frame_tag;
-	atomic_t available_ptp_frame_tag_count;
+	struct page_pool *rx_page_pool;
+	struct bpf_prog *xdp_prog;
+	/* AF_XDP zero-copy socket bound to queue 0. Only changed with dev
+	 * closed, see adi_msp_xsk_pool_setup().
+	 */
+	struct xsk_buff_pool *xsk_pool;
 
-	dma_addr_t rx_skb_dma[ADI_MSP_NUM_RDS];
-	dma_addr_t tx_skb_dma[ADI_MSP_NUM_TDS];
-	dma_addr_t status_wu_dma;
+	struct net_device *dev;
+	struct device *dmadev;
 
-	/* Used to record previous RX SKBs */
-	struct sk_buff *prev_rx_skb[PREV_RX_SKB_NUM];
-	int prev_rx_skb_count;
+	/* E-tile port of dev. With "adi,dual-port" the other port gets a
+	 * netdev of its own, see struct adi_msp_port. Ports without a netdev
+	 * are NULL in port_dev[], and frames received on them go to dev.
+	 */
+	u8 port;
+	struct net_device *port_dev[ADI_MSP_NUM_PORTS];
 
-	int rx_next_done;
+	/* Frame tags each class may hold, indexed by "ptp" */
+	int max_frame_tags[2];
 
-	int tx_next_done;
+	u32 rx_copybreak;
+	u32 tx_copybreak;
+
+	bool has_ptp;
+	bool hwtstamp_tx_en;
+	int hwtstamp_rx_filter;
+	/* ADI_MSP_PTP_* of hwtstamp_rx_filter */
+	u8 hwtstamp_rx_ptp;
+	struct ptp_clock *ptp_clk;
+
+	/* Tx producer */
+
+	atomic_t tx_next_use ____cacheline_aligned_in_smp;
+	/* Where to look for the next free frame tag */
+	u8 next_frame_tag;
+
+	/* Tx chain lock. Tx chain is mostly kicked by Tx producer. */
+	spinlock_t lock;
 	int tx_chain_head;
 	int tx_chain_tail;
 	enum chain_status tx_chain_status;
-	atomic_t tx_count;
+	int tx_dma_halt_cnt;
+	int tx_dma_run_cnt;
+
+	/* Tx accounting, taken by Tx producer and released by Tx status */
+
+	atomic_t tx_count ____cacheline_aligned_in_smp;
+	/* Frame tags each class holds, indexed by "ptp" */
+	atomic_t used_frame_tags[2];
+	/* Frame tags in use, and which of them are used by PTP frames */
+	DECLARE_BITMAP(frame_tag_map, ADI_MSP_FRAME_TAG_MAP_SIZE);
+	DECLARE_BITMAP(ptp_frame_tag_map, ADI_MSP_FRAME_TAG_MAP_SIZE);
+
+	/* Tx status */
+
+	struct napi_struct status_napi ____cacheline_aligned_in_smp;
+	int tx_next_done;
+	int td_next_done;
+	/* See adi_msp_dma_done_count() */
+	u32 status_stale_dscptr;
+	int status_dma_halt_cnt;
+	int status_dma_run_cnt;
+	struct adi_msp_ts_cache tx_ts_cache;
+	struct adi_msp_ctx_stats tx_stats[ADI_MSP_NUM_PORTS];
+	struct adi_msp_lat_hist tx_lat[ADI_MSP_TX_LAT_NUM];
+	/* lat_clear_gen when tx_lat[] was last cleared */
+	u32 tx_lat_gen;
+	/* DMA cannot coalesce interrupts, so DMA done interrupt is unmasked
+	 * by a timer some time after NAPI completes.
+	 */
+	struct hrtimer status_coal_timer;
+	u32 tx_coal_usecs;
+
+	/* Rx */
+
+	struct napi_struct rx_napi ____cacheline_aligned_in_smp;
+	int rx_next_done;
+	u32 rx_stale_dscptr;
+	int rx_dma_halt_cnt;
+	int rx_dma_run_cnt;
+	struct adi_msp_ts_cache rx_ts_cache;
+	struct adi_msp_ctx_stats rx_stats[ADI_MSP_NUM_PORTS];
+	/* When Rx DMA done interrupt scheduled NAPI, 0 if latency_stats was
+	 * off or NAPI was not scheduled by the interrupt
+	 */
+	ktime_t rx_irq_time;
+	struct adi_msp_lat_hist rx_lat;
+	u32 rx_lat_gen;
+	/* Interrupt moderation, the same as Tx status */
+	struct hrtimer rx_coal_timer;
+	u32 rx_coal_usecs;
+	u32 rx_coal_frames;
+	bool rx_dim_enabled;
+	struct dim rx_dim;
+	u16 rx_dim_event_ctr;
+
+	/* Used to record pages of previous Rx data work units. Work units on
+	 * buffers of AF_XDP socket are in prev_rx_xsk[] instead, with NULL
+	 * at the same index of prev_rx_page[].
+	 */
+	struct page *prev_rx_page[PREV_RX_PAGE_NUM];
+	struct xdp_buff *prev_rx_xsk[PREV_RX_PAGE_NUM];
+	int prev_rx_page_count;
 
-	int rx_dmadone_irq;
+	struct xdp_rxq_info xdp_rxq;
+	struct xdp_rxq_info xsk_rxq;
+
+	/* Slow paths */
+
+	int rx_dmadone_irq ____cacheline_aligned_in_smp;
 	int rx_dde_error_irq;
 	int tx_dde_error_irq;
 	int status_dmadone_irq;
 	int status_dde_error_irq;
 
-	struct adi_msp_stats stats;
+	/* CPUs for affinity hints of Rx DMA, Tx DMA and Tx status DMA
+	 * interrupts, -1 if not set. NAPI runs on the CPU taking the interrupt.
+	 */
+	int rx_irq_cpu;
+	int tx_irq_cpu;
+	int status_irq_cpu;
 
-	/* transmit lock */
-	spinlock_t lock;
+	/* Set while adi_msp_open() has rings, IRQs and NAPIs set up. dev may
+	 * be IFF_UP without it if reopening failed, see adi_msp_reopen().
+	 */
+	bool opened;
 
-	int rx_dma_halt_cnt;
-	int rx_dma_run_cnt;
-	struct napi_struct rx_napi;
+	/* Tx is reset in process context, see adi_msp_tx_reset_work() */
+	struct work_struct tx_reset_work;
+	bool tx_resetting;
+	/* Set from when the reset is scheduled until Tx ring is rebuilt.
+	 * Tx status NAPI does nothing meanwhile, see adi_msp_status_poll().
+	 */
+	bool tx_reset_pending;
 
-	int tx_dma_halt_cnt;
-	int tx_dma_run_cnt;
+	/* Netlink counters of each port written from any context, even hard
+	 * IRQ. They are rare, so atomics are good enough.
+	 */
+	atomic64_t tx_errors[ADI_MSP_NUM_PORTS];
+	atomic64_t tx_dropped[ADI_MSP_NUM_PORTS];
+	atomic64_t tx_reset;
+
+	/* Hardware counters are collected by hw_stats_work every
+	 * hw_stats_usecs into stats.hw, which is protected by hw_stats_lock.
+	 * hw_stats_mutex serializes collections. hw_read and hw_last are the
+	 * raw values of this and the last collection.
+	 */
+	struct delayed_work hw_stats_work;
+	u32 hw_stats_usecs;
+	struct mutex hw_stats_mutex;
+	spinlock_t hw_stats_lock;
+	struct adi_msp_hw_stats hw_read;
+	struct adi_msp_hw_stats hw_last;
+
+	/* Filled for ethtool -S, netlink counters by adi_msp_get_nl_stats() */
+	struct adi_msp_stats stats;
 
-	int status_dma_halt_cnt;
-	int status_dma_run_cnt;
-	struct napi_struct status_napi;
+	struct dentry *debugfs_dir;
+	/* Bumped to ask NAPIs to clear their latency histograms */
+	u32 lat_clear_gen;
+};
 
-	struct net_device *dev;
-	struct device *dmadev;
+/* Offset of FIELD of struct adi_msp_private within its cache line. Fields
+ * starting a group written by one context must be at 0, see
+ * adi_msp_probe(). Groups are only aligned on SMP.
+ */
+#define ADI_MSP_CACHELINE_OFFSET(field)					\
+	(IS_ENABLED(CONFIG_SMP) ?					\
+	 offsetof(struct adi_msp_private, field) % SMP_CACHE_BYTES : 0)
 
-	bool has_ptp;
-	bool hwtstamp_tx_en;
-	bool hwtstamp_rx_en;
-	struct ptp_clock *ptp_clk;
+/* Private data of the netdev of the other E-tile port. It has no DMA or
+ * NAPI of its own. Its frames go through the rings of lp tagged with its
+ * port, and it can only pass traffic while lp->dev is up.
+ */
+struct adi_msp_port {
+	struct adi_msp_private *lp;
+	struct net_device *dev;
+	u8 port;
 };
 
+static int adi_msp_open(struct net_device *dev);
+static int adi_msp_close(struct net_device *dev);
+static void adi_msp_reopen(struct net_device *dev);
+
 static int tx_dma_error_interrupt_count;
 static int rx_dma_done_interrupt_count;
 static int rx_dma_error_interrupt_count;
 static int status_dma_done_interrupt_count;
 static int status_dma_error_interrupt_count;
 
-static u8 next_frame_tag(struct adi_msp_private *lp, bool ptp)
+static unsigned int ptp_frame_tags = ADI_MSP_DEF_PTP_FRAME_TAGS;
+module_param(ptp_frame_tags, uint, 0644);
+MODULE_PARM_DESC(ptp_frame_tags,
+		 "Frame tags for PTP frames, the others are for non-PTP frames (default 8)");
+
+static unsigned int rx_napi_weight = NAPI_POLL_WEIGHT;
+module_param(rx_napi_weight, uint, 0444);
+MODULE_PARM_DESC(rx_napi_weight, "Rx NAPI weight, 1 to 64 (default 64)");
+
+static unsigned int status_napi_weight = NAPI_POLL_WEIGHT;
+module_param(status_napi_weight, uint, 0444);
+MODULE_PARM_DESC(status_napi_weight,
+		 "Tx status NAPI weight, 1 to 64 (default 64)");
+
+static bool latency_stats;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats,
+		 "Collect Tx and Rx latency histograms in debugfs, Tx only if set when the interface is opened (default off)");
+
+static struct dentry *adi_msp_debugfs_root;
+
+/* Timestamp for latency histograms, 0 if they are not collected */
+static inline ktime_t adi_msp_lat_time(void)
 {
-	return ptp ? lp->next_ptp_frame_tag : lp->next_nonptp_frame_tag;
+	return READ_ONCE(latency_stats) ? ktime_get() : 0;
 }
 
-static u8 get_frame_tag(struct adi_msp_private *lp, bool ptp)
+/* Clear the histograms at HIST of SIZE bytes if debugfs has asked for it
+ * since the NAPI owning them last looked. *GEN is the NAPI's copy of
+ * lp->lat_clear_gen.
+ */
+static void adi_msp_lat_sync(u32 clear_gen, u32 *gen, void *hist, size_t size)
 {
-	atomic_t *available_count;
-	u8 min_tag, max_tag;
-	u8 tag, *next_tag;
-	const char *type;
-
-	if (ptp) {
-		type = "ptp";
-		available_count = &lp->available_ptp_frame_tag_count;
-		min_tag = ADI_MSP_MIN_PTP_FRAME_TAG;
-		max_tag = ADI_MSP_MAX_PTP_FRAME_TAG;
-		next_tag = &lp->next_ptp_frame_tag;
-	} else {
-		type = "nonptp";
-		available_count = &lp->available_nonptp_frame_tag_count;
-		min_tag = ADI_MSP_MIN_NONPTP_FRAME_TAG;
-		max_tag = ADI_MSP_MAX_NONPTP_FRAME_TAG;
-		next_tag = &lp->next_nonptp_frame_tag;
+	if (unlikely(*gen != clear_gen)) {
+		memset(hist, 0, size);
+		*gen = clear_gen;
 	}
+}
+
+static void adi_msp_lat_add(struct adi_msp_lat_hist *h, u64 ns)
+{
+	int b = ns ? min(fls64(ns) - 1, ADI_MSP_LAT_BUCKETS - 1) : 0;
+
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->bucket[b]++;
+}
 
-	if (atomic_read(available_count) == 0) {
+/* Number of frame tags the class can still get */
+static int frame_tags_left(struct adi_msp_private *lp, bool ptp)
+{
+	return lp->max_frame_tags[ptp] - atomic_read(&lp->used_frame_tags[ptp]);
+}
+
+/* Get a free frame tag for a frame of the class. Frames of both classes can
+ * get tags at the same time, so the tag map is changed by atomic bit
+ * operations. Free tags are searched from the one after the last tag got,
+ * so a tag just put back is not used again at once.
+ *
+ * Returns 0 if the class has used up its share.
+ */
+static u8 get_frame_tag(struct adi_msp_private *lp, bool ptp)
+{
+	const char *type = ptp ? "ptp" : "nonptp";
+	unsigned int tag;
+
+	if (atomic_inc_return(&lp->used_frame_tags[ptp]) >
+	    lp->max_frame_tags[ptp]) {
+		atomic_dec(&lp->used_frame_tags[ptp]);
 		MSP_DBG("%s: no available tags for %s frame\n", lp->dev->name, type);
 		return 0;
 	}
 
-	atomic_dec(available_count);
+	/* The shares of both classes add up to ADI_MSP_NUM_FRAME_TAGS, so
+	 * there is always a free tag for us.
+	 */
+	tag = READ_ONCE(lp->next_frame_tag);
+	for (;;) {
+		tag = find_next_zero_bit(lp->frame_tag_map,
+					 ADI_MSP_FRAME_TAG_MAP_SIZE, tag);
+		if (tag >= ADI_MSP_FRAME_TAG_MAP_SIZE) {
+			tag = 0;
+			continue;
+		}
+		if (!test_and_set_bit(tag, lp->frame_tag_map))
+			break;
+	}
 
-	tag = *next_tag;
+	if (ptp)
+		set_bit(tag, lp->ptp_frame_tag_map);
 
-	if (*next_tag == max_tag)
-		*next_tag = min_tag;
-	else
-		(*next_tag)++;
+	WRITE_ONCE(lp->next_frame_tag, (u8)(tag + 1));
 
 	MSP_DBG("%s: successfully get %s frame tag %d\n", lp->dev->name, type, tag);
 
 	return tag;
 }
 
+/* Put back a frame tag. Tags can be put back in any order. */
 static int put_frame_tag(struct adi_msp_private *lp, u8 tag, bool ptp)
 {
-	atomic_t *available_count;
-	u8 min_tag, max_tag;
-	u8 expected_tag, *last_tag;
-	const char *type;
-
-	if (ptp) {
-		type = "ptp";
-		available_count = &lp->available_ptp_frame_tag_count;
-		min_tag = ADI_MSP_MIN_PTP_FRAME_TAG;
-		max_tag = ADI_MSP_MAX_PTP_FRAME_TAG;
-		last_tag = &lp->last_ptp_frame_tag;
-	} else {
-		type = "nonptp";
-		available_count = &lp->available_nonptp_frame_tag_count;
-		min_tag = ADI_MSP_MIN_NONPTP_FRAME_TAG;
-		max_tag = ADI_MSP_MAX_NONPTP_FRAME_TAG;
-		last_tag = &lp->last_nonptp_frame_tag;
+	const char *type = ptp ? "ptp" : "nonptp";
+	bool tag_ptp;
+
+	if (tag == 0 || !test_bit(tag, lp->frame_tag_map)) {
+		MSP_ERR("%s: put %s frame tag %d is not in use\n", lp->dev->name,
+			type, tag);
+		return -1;
 	}
 
-	if (tag < min_tag || tag > max_tag) {
+	tag_ptp = test_and_clear_bit(tag, lp->ptp_frame_tag_map);
+	clear_bit(tag, lp->frame_tag_map);
+	atomic_dec(&lp->used_frame_tags[tag_ptp]);
+
+	if (tag_ptp != ptp) {
 		MSP_ERR("%s: frame tag %d is not %s frame tag\n", lp->dev->name,
 			tag, type);
 		return -1;
 	}
 
-	atomic_inc(available_count);
+	MSP_DBG("%s: successfully put %s frame tag %d\n", lp->dev->name, type, tag);
 
-	if (*last_tag == max_tag)
-		expected_tag = min_tag;
-	else
-		expected_tag = *last_tag + 1;
+	return 0;
+}
 
-	if (tag != expected_tag) {
-		MSP_ERR("%s: put %s frame tag %d is not expected %d\n", lp->dev->name,
-			type, tag, expected_tag);
-		return -1;
-	}
+/* Share the frame tags between the classes and mark all of them free */
+static void adi_msp_init_frame_tags(struct adi_msp_private *lp)
+{
+	unsigned int n = READ_ONCE(ptp_frame_tags);
 
-	*last_tag = tag;
+	n = clamp_t(unsigned int, n, ADI_MSP_MIN_CLASS_FRAME_TAGS,
+		    ADI_MSP_NUM_FRAME_TAGS - ADI_MSP_MIN_CLASS_FRAME_TAGS);
 
-	MSP_DBG("%s: successfully put %s frame tag %d\n", lp->dev->name, type, tag);
+	lp->max_frame_tags[true] = n;
+	lp->max_frame_tags[false] = ADI_MSP_NUM_FRAME_TAGS - n;
+	atomic_set(&lp->used_frame_tags[true], 0);
+	atomic_set(&lp->used_frame_tags[false], 0);
 
-	return 0;
+	bitmap_zero(lp->frame_tag_map, ADI_MSP_FRAME_TAG_MAP_SIZE);
+	bitmap_zero(lp->ptp_frame_tag_map, ADI_MSP_FRAME_TAG_MAP_SIZE);
+	set_bit(0, lp->frame_tag_map);
+	lp->next_frame_tag = 1;
 }
 
-static u64 get_timestamp_ns(union status_wu *wu)
+/* Convert the 96-bit timestamp of status work unit to nanoseconds. The
+ * seconds of consecutive timestamps are mostly the same, so the nanoseconds
+ * of the seconds are kept in CACHE and only computed again when they change.
+ * ktime_t cannot carry fractions of nanosecond, they are used for rounding.
+ */
+static u64 get_timestamp_ns(struct adi_msp_ts_cache *cache,
+			    union status_wu *wu)
 {
-	u64 second, ns;
+	u64 second;
+	u32 ns, frac;
 
 	second = wu->t.timestamp[3] & 0xffff;
 	second <<= 32;
 	second |= wu->t.timestamp[2];
 
+	if (unlikely(second != cache->second)) {
+		cache->second = second;
+		cache->second_ns = second * NSEC_PER_SEC;
+	}
+
 	ns = wu->t.timestamp[1];
-	ns += second * NSEC_PER_SEC;
+	frac = wu->t.timestamp[0] >> 16;
 
-	return ns;
+	return cache->second_ns + ns + (frac >> 15);
 }
 
 static void adi_msp_enable_rx_dma_interrupts(struct adi_msp_private *lp, u8 ints)
@@ -826,140 +1285,484 @@ static void adi_msp_disable_status_dma_interrupts(struct adi_msp_private *lp, u8
 
 static dma_addr_t adi_msp_rx_dma(struct adi_msp_private *lp, int idx)
 {
-	return lp->rd_dma + (idx & ADI_MSP_RDS_MASK) * sizeof(struct dma_desc);
+	return lp->rd_dma + (idx & ADI_MSP_RDS_MASK(lp)) * sizeof(struct dma_desc);
 }
 
 static dma_addr_t adi_msp_tx_dma(struct adi_msp_private *lp, int idx)
 {
-	return lp->td_dma + (idx & ADI_MSP_TDS_MASK) * sizeof(struct dma_desc);
+	return lp->td_dma + (idx & ADI_MSP_TDS_MASK(lp)) * sizeof(struct dma_desc);
 }
 
 static dma_addr_t adi_msp_status_dma(struct adi_msp_private *lp, int idx)
 {
-	return lp->sd_dma + (idx & ADI_MSP_SDS_MASK) * sizeof(struct dma_desc);
+	return lp->sd_dma + (idx & ADI_MSP_SDS_MASK(lp)) * sizeof(struct dma_desc);
 }
 
 static dma_addr_t adi_msp_status_wu_dma(struct adi_msp_private *lp, int idx)
 {
-	return lp->status_wu_dma + (idx & ADI_MSP_SDS_MASK) * STATUS_WU_BUF_SIZE;
+	return lp->status_wu_dma + (idx & ADI_MSP_SDS_MASK(lp)) * STATUS_WU_BUF_SIZE;
 }
 
 static union status_wu *adi_msp_status_wu(struct adi_msp_private *lp, int idx)
 {
 	u8 *wu;
 
-	wu = lp->status_wu + (idx & ADI_MSP_SDS_MASK) * STATUS_WU_BUF_SIZE;
+	wu = lp->status_wu + (idx & ADI_MSP_SDS_MASK(lp)) * STATUS_WU_BUF_SIZE;
 
 	return (union status_wu *)wu;
 }
 
-/* transmit packet */
-static int adi_msp_send_packet(struct sk_buff *skb, struct net_device *dev)
+static dma_addr_t adi_msp_tx_bounce_dma(struct adi_msp_private *lp, int idx)
 {
-	struct adi_msp_private *lp = netdev_priv(dev);
-	unsigned char *wu;
-	struct tx_wu_header *hdr;
-	u8 ptp = 0, tx_port, tag;
-	atomic_t *available_frame_tag_count;
-	u32 chain_prev, chain_next;
-	unsigned long flags;
-	struct dma_desc *td;
-	dma_addr_t as; // addrstart
-	u32 msize, xmod;
-	u32 frame_length, wu_length, dma_stat;
-	int delta_headroom;
-#if defined(CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8) || defined(CONFIG_ADI_MSP_TX_PADDING)
-	int delta_tailroom, needed_tailroom;
-#endif
-	int idx;
-
-	MSP_DBG("%s: Entering %s ...\n", dev->name, __func__);
-
-	if ((skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP) != 0)
-		ptp = TX_WU_PTP;
+	return lp->tx_bounce_dma + (idx & ADI_MSP_TDS_MASK(lp)) * TX_BOUNCE_BUF_SIZE;
+}
 
-	if (ptp)
-		available_frame_tag_count = &lp->available_ptp_frame_tag_count;
-	else
-		available_frame_tag_count = &lp->available_nonptp_frame_tag_count;
+static u8 *adi_msp_tx_bounce(struct adi_msp_private *lp, int idx)
+{
+	return lp->tx_bounce + (idx & ADI_MSP_TDS_MASK(lp)) * TX_BOUNCE_BUF_SIZE;
+}
 
-	spin_lock_irqsave(&lp->lock, flags);
+/* Find out how many work units from NEXT_DONE on have been done by DMA.
+ *
+ * DSCPTR_PREV holds the initial descriptor of the last work unit DMA has
+ * done, so all work units up to it are done. It's read once for all of
+ * them instead of checking each work unit against the DMA registers.
+ *
+ * DMA never goes past the one before NEXT_DONE, since that is where the
+ * chain stops. When DSCPTR_PREV points to it, either no or all work units
+ * are done. Then check the first work unit as before: if the current
+ * address is still in it and its initial descriptor address has not been
+ * copied into DSCPTR_PREV, it's not done yet.
+ *
+ * DMA is restarted from the first descriptor on open and Tx reset, often
+ * with the rings at the same addresses as before. DSCPTR_PREV still holds
+ * the last descriptor of the previous run then, so its value at restart is
+ * kept in STALE and not trusted until DMA has changed it.
+ *
+ * Only called when the first byte of work unit NEXT_DONE is not zero.
+ */
+static int adi_msp_dma_done_count(struct dma_regs __iomem *regs,
+				  struct dma_desc *ring, dma_addr_t ring_dma,
+				  int mask, int next_done, u32 wu_len,
+				  u32 *stale)
+{
+	u32 addr_cur, dscptr_prv, addrstart;
+	bool valid = true;
+	u32 prv;
+	int done;
 
-	MSP_DBG("%s: tx_count = %d\n", dev->name, atomic_read(&lp->tx_count));
+	dscptr_prv = readl(&regs->dscptr_prv);
+	dscptr_prv &= ~0x3;
 
-	/* we cannot support skb length larger than 0xffff */
-	/* TODO  find a better value related to MTU */
-	if (skb->len > 0xffff) {
-		MSP_ERR("%s: SKB too huge (len = %u)!\n", dev->name, skb->len);
-		goto drop_packet;
+	if (unlikely(*stale != ADI_MSP_DSCPTR_NONE)) {
+		if (dscptr_prv == *stale)
+			valid = false;
+		else
+			*stale = ADI_MSP_DSCPTR_NONE;
 	}
 
-	/* TODO  remove this when the code becomes stable */
-	if (atomic_read(&lp->tx_count) > ADI_MSP_NUM_TDS) {
-		MSP_ERR("%s: tx_count (%d) > ADI_MSP_NUM_TDS (%d) !\n", dev->name,
-			atomic_read(&lp->tx_count), ADI_MSP_NUM_TDS);
-		goto drop_packet;
+	prv = (dscptr_prv - ring_dma) / sizeof(struct dma_desc);
+	if (valid && dscptr_prv >= ring_dma && prv <= mask) {
+		done = (prv - next_done + 1) & mask;
+		if (done > 0)
+			return done;
 	}
 
-	if (atomic_read(&lp->tx_count) == ADI_MSP_NUM_TDS) {
-		MSP_DBG("%s: tx ring is full, drop packet\n", dev->name);
-		goto drop_packet;
-	}
-	if (atomic_read(available_frame_tag_count) == 0) {
-		MSP_DBG("%s: no available %s frame tags, drop packet\n", dev->name,
-			ptp ? "ptp" : "nonptp");
-		goto drop_packet;
-	}
-	if (!netif_queue_stopped(dev) &&
-	    (atomic_read(&lp->tx_count) >= ADI_MSP_NUM_TDS - ADI_MSP_STOP_QUEUE_TH ||
-	     atomic_read(available_frame_tag_count) <= ADI_MSP_STOP_QUEUE_TH)) {
-		MSP_DBG("%s: call netif_stop_queue()\n", dev->name);
-		netif_stop_queue(dev);
-	}
+	addr_cur = readl(&regs->addr_cur);
+	addrstart = ring[next_done].addrstart;
+	if (addr_cur >= addrstart &&
+	    addr_cur < addrstart + wu_len &&
+	    (!valid ||
+	     dscptr_prv != ring_dma + next_done * sizeof(struct dma_desc)))
+		return 0;
 
-#if 1
-	/* make sure that there is enough headroom for workunit header */
-	if (skb_headroom(skb) < TX_WU_HEADER_LEN)
-		delta_headroom = TX_WU_HEADER_LEN - skb_headroom(skb);
-	else
-		delta_headroom = 0;
+	return 1;
+}
 
-#ifdef CONFIG_ADI_MSP_TX_PADDING
-	frame_length = max(skb->len, TX_MIN_FRAME_SIZE);
-#else
-	frame_length = skb->len;
-#endif
+/* Value of DSCPTR_PREV before DMA is restarted from the first descriptor */
+static u32 adi_msp_stale_dscptr(struct dma_regs __iomem *regs)
+{
+	return readl(&regs->dscptr_prv) & ~0x3;
+}
 
-#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
-	wu_length = round_up(frame_length + TX_WU_HEADER_LEN, 8);
-#else
-	wu_length = frame_length + TX_WU_HEADER_LEN;
-#endif
+static u8 *adi_msp_rx_page_wu(struct page *page)
+{
+	return (u8 *)page_address(page) + RX_WU_HEADROOM;
+}
 
-	/* make sure that there is enough tailroom for pads */
-	needed_tailroom = wu_length - (skb->len + TX_WU_HEADER_LEN);
-	if (needed_tailroom > skb_tailroom(skb))
-		delta_tailroom = needed_tailroom - skb_tailroom(skb);
-	else
-		delta_tailroom = 0;
+static u8 *adi_msp_rx_wu(struct adi_msp_private *lp, int idx)
+{
+	if (lp->rx_buf[idx].xsk)
+		return lp->rx_buf[idx].xdp->data;
+	return adi_msp_rx_page_wu(lp->rx_buf[idx].page);
+}
 
-	if (delta_headroom > 0 || delta_tailroom > 0) {
-		if (pskb_expand_head(skb, delta_headroom, delta_tailroom,
-				     GFP_ATOMIC) != 0) {
-			MSP_ERR("%s: No enough headroom or tailroom for Tx work unit\n",
-				dev->name);
-			goto drop_packet;
+/* Clear the first byte of Rx work unit and give it to Rx DMA. The page pool
+ * maps pages DMA_BIDIRECTIONAL, so the sync writes the cleared byte back to
+ * memory instead of discarding it. LEN only needs to cover the cache lines
+ * the CPU might have dirtied.
+ */
+static void adi_msp_rx_arm(struct adi_msp_private *lp, int idx, u32 len)
+{
+	adi_msp_rx_wu(lp, idx)[0] = 0;
+	dma_sync_single_for_device(lp->dmadev, lp->rx_buf[idx].dma, len,
+				   DMA_BIDIRECTIONAL);
+}
+
+/* Put a page from the page pool into Rx descriptor IDX. With AF_XDP socket
+ * bound, a buffer from its fill ring is taken first. The page pool is still
+ * the fallback when the fill ring is empty, so Rx ring never runs dry.
+ */
+static int adi_msp_rx_refill(struct adi_msp_private *lp, int idx)
+{
+	struct adi_msp_rx_buf *rb = &lp->rx_buf[idx];
+	struct xdp_buff *xdp;
+	struct page *page;
+
+	if (lp->xsk_pool) {
+		xdp = xsk_buff_alloc(lp->xsk_pool);
+		if (xdp) {
+			rb->xdp = xdp;
+			rb->dma = xsk_buff_xdp_get_dma(xdp);
+			rb->xsk = true;
+			adi_msp_rx_arm(lp, idx, RX_WU_LEN);
+			return 0;
 		}
 	}
 
-#ifdef CONFIG_ADI_MSP_TX_PADDING
-	if (skb->len < TX_MIN_FRAME_SIZE)
+	page = page_pool_dev_alloc_pages(lp->rx_page_pool);
+	if (unlikely(!page))
+		return -ENOMEM;
+
+	rb->page = page;
+	rb->dma = page_pool_get_dma_addr(page) + RX_WU_HEADROOM;
+	rb->xsk = false;
+
+	/* A page new to the pool is mapped without CPU sync. Write back
+	 * the whole work unit, or dirty cache lines left by its previous
+	 * user could be evicted over the received data.
+	 */
+	adi_msp_rx_arm(lp, idx, RX_WU_LEN);
+
+	return 0;
+}
+
+/* Fill a Tx DMA descriptor. All descriptors of a frame except the last one
+ * must transfer exactly LEN bytes, otherwise the extra bytes would end up in
+ * the middle of the frame. So their MSIZE is limited by LEN, too.
+ */
+static void adi_msp_fill_tx_desc(struct dma_desc *td, dma_addr_t as, u32 len,
+				 bool last)
+{
+	u32 msize, xmod;
+
+	if (last)
+		msize = min(__builtin_ctz(as), 3);
+	else
+		msize = min(__builtin_ctz(as | len), 3);
+	xmod = 1 << msize;
+
+	td->addrstart = as;
+	td->cfg = TX_DMA_CFG_COMMON | msize << 8 |
+		  (last ? DMA_CFG_FLOW_STOP : DMA_CFG_FLOW_DSCL);
+	td->xcnt = (len + xmod - 1) / xmod;
+	td->xmod = xmod;
+}
+
+/* Unmap the Tx buffers of the frame which uses NR_DESCS descriptors starting
+ * from IDX. The first one is the linear data, the others are page fragments
+ * or pads. Pads and XDP_TX frames on Rx pages are not mapped for each frame,
+ * so their length is left zero.
+ */
+static void adi_msp_unmap_tx_skb(struct adi_msp_private *lp, int idx,
+				 int nr_descs)
+{
+	int i, j;
+
+	if (lp->tx_buf[idx].dma_len)
+		dma_unmap_single(lp->dmadev, lp->tx_buf[idx].dma,
+				 lp->tx_buf[idx].dma_len, DMA_TO_DEVICE);
+	lp->tx_buf[idx].dma_len = 0;
+
+	for (i = 1; i < nr_descs; i++) {
+		j = (idx + i) & ADI_MSP_TDS_MASK(lp);
+		if (lp->tx_buf[j].dma_len)
+			dma_unmap_page(lp->dmadev, lp->tx_buf[j].dma,
+				       lp->tx_buf[j].dma_len, DMA_TO_DEVICE);
+		lp->tx_buf[j].dma_len = 0;
+	}
+}
+
+/* Link the filled frames into the Tx chain in ring order and start Tx DMA
+ * on the chain if it's halted. Frames are filled by adi_msp_xmit()
+ * without holding any lock. Only here the Tx chain is changed, so this is
+ * the only critical section of the Tx path. Must be called with lp->lock.
+ */
+static void adi_msp_tx_kick_locked(struct adi_msp_private *lp)
+{
+	struct net_device *dev = lp->dev;
+	int idx = lp->tx_chain_tail;
+	int head = idx;
+	u32 chain_prev, dma_stat;
+	ktime_t now = 0;
+	bool linked = false;
+	u8 nr_descs;
+
+	/* Pairs with smp_mb() in adi_msp_xmit(). Either this sees the frame
+	 * published there, or that sees the frames published before this.
+	 */
+	smp_mb__after_spinlock();
+
+	/* Pairs with smp_store_release() in adi_msp_xmit() */
+	while ((nr_descs = smp_load_acquire(&lp->tx_buf[idx].pending)) != 0) {
+		lp->tx_buf[idx].pending = 0;
+		linked = true;
+
+		if (lp->tx_time && lp->tx_time[idx].xmit) {
+			if (!now)
+				now = ktime_get();
+			lp->tx_time[idx].kick = now;
+		}
+
+		if (lp->tx_chain_status == EMPTY) {
+			MSP_DBG("%s: chain is empty, create a new chain, head %d\n",
+				dev->name, idx);
+
+			lp->tx_chain_status = FILLED;
+		} else {
+			MSP_DBG("%s: chain is filled, link in td %d\n",
+				dev->name, idx);
+
+			/* Link to prev. DMA does not see the chain until it's
+			 * started below, and writel() orders these writes
+			 * before starting DMA.
+			 */
+			chain_prev = (idx - 1) & ADI_MSP_TDS_MASK(lp);
+			lp->td_ring[chain_prev].dscptr_nxt = adi_msp_tx_dma(lp, idx);
+			lp->td_ring[chain_prev].cfg |= DMA_CFG_FLOW_DSCL;
+		}
+
+		/* Move tail */
+		idx = (idx + nr_descs) & ADI_MSP_TDS_MASK(lp);
+		lp->tx_chain_tail = idx;
+	}
+
+	if (linked)
+		trace_adi_msp_tx_kick(dev, head, idx);
+
+	if (lp->tx_chain_status == EMPTY)
+		return;
+
+	dma_stat = readl(&lp->tx_dma_regs->stat);
+	if (DMA_STAT_RUN(dma_stat) == DMA_STAT_HALT) {
+		MSP_DBG("%s: Tx DMA is halted and chain is filled, start DMA from chain head %d\n",
+			dev->name, lp->tx_chain_head);
+
+		writel(adi_msp_tx_dma(lp, lp->tx_chain_head),
+		       &lp->tx_dma_regs->dscptr_nxt);
+		writel(TX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
+		       &lp->tx_dma_regs->cfg);
+
+		/* Move head to tail */
+		lp->tx_chain_head = lp->tx_chain_tail;
+		lp->tx_chain_status = EMPTY;
+
+		netif_trans_update(dev);
+	} else {
+		MSP_DBG("%s: Tx DMA is running\n", dev->name);
+	}
+}
+
+/* Number of Tx descriptors Tx queue is allowed to fill */
+static inline int adi_msp_txq_num_tds(struct adi_msp_private *lp,
+				      u16 queue)
+{
+	if (queue == ADI_MSP_TXQ_PTP)
+		return lp->num_tds;
+	return lp->num_tds - ADI_MSP_PTP_RESERVED_TDS;
+}
+
+/* Whether Tx queue has room for one more frame of any size */
+static bool adi_msp_txq_has_room(struct adi_msp_private *lp, u16 queue)
+{
+	return atomic_read(&lp->tx_count) + ADI_MSP_TX_MAX_DESCS <=
+	       adi_msp_txq_num_tds(lp, queue) &&
+	       frame_tags_left(lp, queue == ADI_MSP_TXQ_PTP) >
+	       ADI_MSP_STOP_QUEUE_TH;
+}
+
+static inline u8 adi_msp_tx_wu_port(u8 port)
+{
+	return port ? TX_WU_PORT_1 : TX_WU_PORT_0;
+}
+
+/* Port of lp->dev or of the netdev of the other port */
+static int adi_msp_dev_port(struct adi_msp_private *lp, struct net_device *dev)
+{
+	struct adi_msp_port *pp;
+
+	if (dev == lp->dev)
+		return lp->port;
+
+	pp = netdev_priv(dev);
+	return pp->port;
+}
+
+static inline void adi_msp_stats_add_frame(struct adi_msp_ctx_stats *cs,
+					   u32 len)
+{
+	u64_stats_update_begin(&cs->syncp);
+	cs->packets++;
+	cs->bytes += len;
+	u64_stats_update_end(&cs->syncp);
+}
+
+static u16 adi_msp_select_queue(struct net_device *dev, struct sk_buff *skb,
+				struct net_device *sb_dev)
+{
+	if ((skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP) != 0)
+		return ADI_MSP_TXQ_PTP;
+
+	return ADI_MSP_TXQ_NONPTP;
+}
+
+/* transmit packet
+ *
+ * Tx descriptors are reserved with atomic operations on tx_count and
+ * tx_next_use. The frame is filled into the reserved descriptors without
+ * holding lp->lock. Then it's marked pending and adi_msp_tx_kick_locked()
+ * links it into the Tx chain.
+ *
+ * Each class of frames (PTP or non-PTP) has its own Tx queue and its own
+ * share of frame tags, which the queue is stopped on. So the class is
+ * decided by the queue adi_msp_select_queue() has picked, not by the SKB
+ * itself.
+ *
+ * When the stack tells us more frames are coming, the frame is left pending
+ * and the last frame of the burst links all of them and starts Tx DMA. So
+ * Tx DMA status register is read only once for a burst.
+ *
+ * DEV is lp->dev or the netdev of the other port. Its Tx queues and BQL are
+ * used, and the frame is sent on PORT.
+ */
+static int adi_msp_xmit(struct adi_msp_private *lp, struct sk_buff *skb,
+			struct net_device *dev, u8 port)
+{
+	u16 queue = skb_get_queue_mapping(skb);
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, queue);
+	unsigned char *wu;
+	struct tx_wu_header *hdr;
+	u8 ptp = 0, tx_port, tag;
+	unsigned long flags;
+	bool kick;
+	struct dma_desc *td;
+	dma_addr_t as[ADI_MSP_TX_MAX_DESCS]; // addrstart
+	u32 len[ADI_MSP_TX_MAX_DESCS];
+	u32 frame_length, wu_length, pad_length;
+	int nr_frags, nr_descs, nr_mapped;
+	bool bounce;
+	int delta_headroom;
+	int delta_tailroom, needed_tailroom;
+	int idx, next, i;
+	bool busy = false;
+	ktime_t xmit_time = lp->tx_time ? adi_msp_lat_time() : 0;
+
+	MSP_DBG("%s: Entering %s ...\n", dev->name, __func__);
+
+	trace_adi_msp_xmit(dev, skb);
+
+	nr_frags = skb_shinfo(skb)->nr_frags;
+
+	if (queue == ADI_MSP_TXQ_PTP)
+		ptp = TX_WU_PTP;
+
+	MSP_DBG("%s: tx_count = %d\n", dev->name, atomic_read(&lp->tx_count));
+
+	/* we cannot support skb length larger than 0xffff */
+	/* TODO  find a better value related to MTU */
+	if (skb->len > 0xffff) {
+		MSP_ERR("%s: SKB too huge (len = %u)!\n", dev->name, skb->len);
+		goto drop_packet;
+	}
+
+	/* TODO  remove this when the code becomes stable */
+	if (atomic_read(&lp->tx_count) > lp->num_tds) {
+		MSP_ERR("%s: tx_count (%d) > num_tds (%d) !\n", dev->name,
+			atomic_read(&lp->tx_count), lp->num_tds);
+		goto drop_packet;
+	}
+
+#ifdef CONFIG_ADI_MSP_TX_PADDING
+	frame_length = max(skb->len, TX_MIN_FRAME_SIZE);
+#else
+	frame_length = skb->len;
+#endif
+
+#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
+	wu_length = round_up(frame_length + TX_WU_HEADER_LEN, 8);
+#else
+	wu_length = frame_length + TX_WU_HEADER_LEN;
+#endif
+
+	pad_length = wu_length - (skb->len + TX_WU_HEADER_LEN);
+
+	/* Bounced frame needs only one descriptor. Paged SKB needs one more
+	 * descriptor for pads.
+	 */
+	bounce = skb->len < READ_ONCE(lp->tx_copybreak);
+	if (bounce) {
+		nr_descs = 1;
+	} else {
+		nr_descs = 1 + nr_frags;
+		if (nr_frags && pad_length)
+			nr_descs++;
+	}
+
+	if (atomic_read(&lp->tx_count) + nr_descs > adi_msp_txq_num_tds(lp, queue)) {
+		MSP_DBG("%s: tx ring is full, requeue packet\n", dev->name);
+		goto tx_busy;
+	}
+	if (frame_tags_left(lp, ptp) <= 0) {
+		MSP_DBG("%s: no available %s frame tags, requeue packet\n",
+			dev->name, ptp ? "ptp" : "nonptp");
+		goto tx_busy;
+	}
+
+#if 1
+	/* make sure that there is enough headroom for workunit header */
+	if (bounce)
+		delta_headroom = 0;
+	else if (skb_headroom(skb) < TX_WU_HEADER_LEN)
+		delta_headroom = TX_WU_HEADER_LEN - skb_headroom(skb);
+	else
+		delta_headroom = 0;
+
+	/* make sure that there is enough tailroom for pads. Pads of paged
+	 * SKB are transferred from lp->tx_pad.
+	 */
+	needed_tailroom = (nr_frags || bounce) ? 0 : pad_length;
+	if (needed_tailroom > skb_tailroom(skb))
+		delta_tailroom = needed_tailroom - skb_tailroom(skb);
+	else
+		delta_tailroom = 0;
+
+	if (delta_headroom > 0 || delta_tailroom > 0) {
+		if (pskb_expand_head(skb, delta_headroom, delta_tailroom,
+				     GFP_ATOMIC) != 0) {
+			MSP_ERR("%s: No enough headroom or tailroom for Tx work unit\n",
+				dev->name);
+			goto drop_packet;
+		}
+	}
+
+#ifdef CONFIG_ADI_MSP_TX_PADDING
+	if (!nr_frags && !bounce && skb->len < TX_MIN_FRAME_SIZE)
 		skb_put(skb, TX_MIN_FRAME_SIZE - skb->len);
 #endif
 
 #else /* if no workarounds are needed, we can just use this simple one */
 	/* make sure that there is enough headroom in SKB for workunit header */
-	if (skb_headroom(skb) < TX_WU_HEADER_LEN) {
+	if (!bounce && skb_headroom(skb) < TX_WU_HEADER_LEN) {
 		skb = skb_expand_head(skb, TX_WU_HEADER_LEN);
 		if (!skb) {
 			MSP_ERR("%s: No enough headroom for Tx work unit header\n", dev->name);
@@ -968,15 +1771,27 @@ static int adi_msp_send_packet(struct sk_buff *skb, struct net_device *dev)
 	}
 #endif
 
-	/* TODO  find out how to determine which port to use. assume port 0 */
-	tx_port = TX_WU_PORT_0;
+	tx_port = adi_msp_tx_wu_port(port);
 
-	/* take a peek but not get it now */
-	tag = next_frame_tag(lp, ptp);
+	/* Another port might have taken the last one since the check */
+	tag = get_frame_tag(lp, ptp);
+	if (!tag) {
+		MSP_DBG("%s: no available %s frame tags, requeue packet\n",
+			dev->name, ptp ? "ptp" : "nonptp");
+		goto tx_busy;
+	}
 
-	if (ptp)
+	/* Frames sent on PTP queue without asking for a timestamp use PTP
+	 * frame tags too. Their timestamps are just not reported.
+	 */
+	if (ptp && (skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP) != 0)
 		skb_shinfo(skb)->tx_flags |= SKBTX_IN_PROGRESS;
 
+	/* Bounce buffer is filled once its descriptor is reserved */
+	nr_mapped = 0;
+	if (bounce)
+		goto reserve_descs;
+
 	/* fill work unit header */
 	wu = skb->data - TX_WU_HEADER_LEN;
 	hdr = (struct tx_wu_header *)wu;
@@ -984,111 +1799,541 @@ static int adi_msp_send_packet(struct sk_buff *skb, struct net_device *dev)
 	hdr->frame_tag = tag;
 	hdr->frame_len = frame_length;
 
-	as = dma_map_single(lp->dmadev, wu, wu_length, DMA_TO_DEVICE);
-	if (dma_mapping_error(lp->dmadev, as)) {
-		skb_shinfo(skb)->tx_flags &= ~SKBTX_IN_PROGRESS;
-		goto drop_packet;
+	/* Map the buffers before reserving descriptors, so a reserved
+	 * descriptor will always be filled. The first one is for the work
+	 * unit header and the linear data. Then one for each page fragment.
+	 */
+	len[0] = nr_frags ? skb_headlen(skb) + TX_WU_HEADER_LEN : wu_length;
+	as[0] = dma_map_single(lp->dmadev, wu, len[0], DMA_TO_DEVICE);
+	if (dma_mapping_error(lp->dmadev, as[0]))
+		goto drop_packet_in_progress;
+	nr_mapped = 1;
+
+	for (i = 1; i < nr_descs; i++) {
+		if (i <= nr_frags) {
+			skb_frag_t *frag = &skb_shinfo(skb)->frags[i - 1];
+
+			len[i] = skb_frag_size(frag);
+			as[i] = skb_frag_dma_map(lp->dmadev, frag, 0, len[i],
+						 DMA_TO_DEVICE);
+			if (dma_mapping_error(lp->dmadev, as[i]))
+				goto unmap_packet;
+			nr_mapped++;
+		} else {
+			len[i] = pad_length;
+			as[i] = lp->tx_pad_dma;
+		}
 	}
 
-	/* get it now */
-	get_frame_tag(lp, ptp);
+reserve_descs:
+	/* Reserve descriptors */
+	if (atomic_add_return(nr_descs, &lp->tx_count) >
+	    adi_msp_txq_num_tds(lp, queue)) {
+		atomic_sub(nr_descs, &lp->tx_count);
+		MSP_DBG("%s: tx ring is full, requeue packet\n", dev->name);
+		busy = true;
+		goto unmap_packet;
+	}
+	idx = atomic_fetch_add(nr_descs, &lp->tx_next_use) & ADI_MSP_TDS_MASK(lp);
+	MSP_DBG("%s: index = %d\n", dev->name, idx);
 
-	atomic_inc(&lp->tx_count);
+	if (bounce) {
+		wu = adi_msp_tx_bounce(lp, idx);
+		hdr = (struct tx_wu_header *)wu;
+		hdr->byte0 = WU_TYPE_TX_DATA_SOF | ptp | tx_port;
+		hdr->frame_tag = tag;
+		hdr->frame_len = frame_length;
+		skb_copy_bits(skb, 0, wu + TX_WU_HEADER_LEN, skb->len);
+		memset(wu + TX_WU_HEADER_LEN + skb->len, 0, pad_length);
+
+		len[0] = wu_length;
+		as[0] = adi_msp_tx_bounce_dma(lp, idx);
+	}
 
-	idx = lp->tx_chain_tail;
-	MSP_DBG("%s: index = %d\n", dev->name, idx);
-	td = &lp->td_ring[idx];
+	/* setup the transmit DMA descriptor(s). */
+	for (i = 0; i < nr_descs; i++) {
+		next = (idx + i) & ADI_MSP_TDS_MASK(lp);
+		td = &lp->td_ring[next];
+
+		if (i > 0)
+			lp->td_ring[(next - 1) & ADI_MSP_TDS_MASK(lp)].dscptr_nxt =
+				adi_msp_tx_dma(lp, next);
+		adi_msp_fill_tx_desc(td, as[i], len[i], i == nr_descs - 1);
+		lp->tx_buf[next].dma = as[i];
+		/* Pads and bounce buffers are not mapped for each frame */
+		lp->tx_buf[next].dma_len = (bounce || i > nr_frags) ? 0 : len[i];
+	}
+
+	lp->tx_buf[idx].skb = skb;
+	lp->tx_buf[idx].descs = nr_descs;
+	lp->tx_buf[idx].bounced = bounce;
+	if (lp->tx_time)
+		lp->tx_time[idx].xmit = xmit_time;
+
+	/* Publish the filled frame to adi_msp_tx_kick_locked() */
+	smp_store_release(&lp->tx_buf[idx].pending, nr_descs);
+
+	if (!adi_msp_txq_has_room(lp, queue)) {
+		MSP_DBG("%s: stop Tx queue %d\n", dev->name, queue);
+		netif_tx_stop_queue(txq);
+
+		/* Pairs with smp_mb() in adi_msp_status(). In case it has
+		 * released everything before the queue was stopped.
+		 */
+		smp_mb();
+		if (adi_msp_txq_has_room(lp, queue))
+			netif_tx_wake_queue(txq);
+	}
+
+	kick = __netdev_tx_sent_queue(txq, frame_length, netdev_xmit_more());
+
+	/* Another producer, e.g. of PTP queue, might have published a frame
+	 * after this one and failed to link it, since this one was not
+	 * published yet. Don't hold it back until this burst ends.
+	 */
+	if (!kick) {
+		smp_mb();
+		next = (idx + nr_descs) & ADI_MSP_TDS_MASK(lp);
+		kick = READ_ONCE(lp->tx_buf[next].pending) != 0;
+	}
+
+	if (kick) {
+		spin_lock_irqsave(&lp->lock, flags);
+		adi_msp_tx_kick_locked(lp);
+		spin_unlock_irqrestore(&lp->lock, flags);
+	}
+
+	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
+	return NETDEV_TX_OK;
+
+unmap_packet:
+	if (nr_mapped)
+		dma_unmap_single(lp->dmadev, as[0], len[0], DMA_TO_DEVICE);
+	for (i = 1; i < nr_mapped; i++)
+		dma_unmap_page(lp->dmadev, as[i], len[i], DMA_TO_DEVICE);
+drop_packet_in_progress:
+	skb_shinfo(skb)->tx_flags &= ~SKBTX_IN_PROGRESS;
+	put_frame_tag(lp, tag, ptp);
+	if (busy)
+		goto tx_busy;
+drop_packet:
+	MSP_DBG("%s: drop the packet\n", dev->name);
+	atomic64_inc(&lp->tx_dropped[port]);
+	dev_kfree_skb_any(skb);
+
+	/* Don't leave the pending frames of this burst behind */
+	if (!netdev_xmit_more() || netif_xmit_stopped(txq)) {
+		spin_lock_irqsave(&lp->lock, flags);
+		adi_msp_tx_kick_locked(lp);
+		spin_unlock_irqrestore(&lp->lock, flags);
+	}
+
+	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
+	return NETDEV_TX_OK;
+
+tx_busy:
+	/* Out of descriptors or frame tags. Stop the queue and let the stack
+	 * requeue the frame. Pairs with smp_mb() in adi_msp_status(), which
+	 * wakes the queue once there is room. In case it has released
+	 * everything before the queue was stopped, check again.
+	 */
+	netif_tx_stop_queue(txq);
+	smp_mb();
+	if (adi_msp_txq_has_room(lp, queue))
+		netif_tx_wake_queue(txq);
+
+	/* The burst ends here, link its pending frames */
+	spin_lock_irqsave(&lp->lock, flags);
+	adi_msp_tx_kick_locked(lp);
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
+	return NETDEV_TX_BUSY;
+}
+
+static int adi_msp_send_packet(struct sk_buff *skb, struct net_device *dev)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	return adi_msp_xmit(lp, skb, dev, lp->port);
+}
+
+/* Fill an XDP frame into the Tx ring and mark it pending. The caller kicks
+ * Tx DMA. XDP frames are sent like the frames on non-PTP Tx queue and use
+ * non-PTP frame tags, so the caller must hold the xmit lock of that queue.
+ *
+ * Frames of XDP_TX are still on the pages of Rx page pool, which are mapped
+ * already. Other frames are mapped here if DMA_MAP is set. The work unit
+ * header is put in the headroom of the frame, the pads are transferred from
+ * lp->tx_pad.
+ */
+static int adi_msp_xdp_xmit_frame(struct adi_msp_private *lp,
+				  struct xdp_frame *xdpf, bool dma_map)
+{
+	struct netdev_queue *txq =
+		netdev_get_tx_queue(lp->dev, ADI_MSP_TXQ_NONPTP);
+	struct tx_wu_header *hdr;
+	struct dma_desc *td;
+	dma_addr_t as[2]; // addrstart
+	u32 len[2];
+	u32 frame_length, wu_length, pad_length;
+	int nr_descs, idx, next, i;
+	u8 tag;
+
+	if (unlikely(xdpf->headroom < TX_WU_HEADER_LEN))
+		return -EINVAL;
+
+#ifdef CONFIG_ADI_MSP_TX_PADDING
+	frame_length = max_t(u32, xdpf->len, TX_MIN_FRAME_SIZE);
+#else
+	frame_length = xdpf->len;
+#endif
+
+#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
+	wu_length = round_up(frame_length + TX_WU_HEADER_LEN, 8);
+#else
+	wu_length = frame_length + TX_WU_HEADER_LEN;
+#endif
+
+	pad_length = wu_length - (xdpf->len + TX_WU_HEADER_LEN);
+	nr_descs = pad_length ? 2 : 1;
+
+	if (atomic_read(&lp->tx_count) + nr_descs >
+	    adi_msp_txq_num_tds(lp, ADI_MSP_TXQ_NONPTP))
+		return -ENOSPC;
+
+	tag = get_frame_tag(lp, false);
+	if (!tag)
+		return -ENOSPC;
+
+	hdr = (struct tx_wu_header *)((u8 *)xdpf->data - TX_WU_HEADER_LEN);
+	hdr->byte0 = WU_TYPE_TX_DATA_SOF | adi_msp_tx_wu_port(lp->port);
+	hdr->frame_tag = tag;
+	hdr->frame_len = frame_length;
+
+	len[0] = xdpf->len + TX_WU_HEADER_LEN;
+	if (dma_map) {
+		as[0] = dma_map_single(lp->dmadev, hdr, len[0], DMA_TO_DEVICE);
+		if (dma_mapping_error(lp->dmadev, as[0])) {
+			put_frame_tag(lp, tag, false);
+			return -ENOMEM;
+		}
+	} else {
+		/* xdp_frame is at the start of the page */
+		as[0] = page_pool_get_dma_addr(virt_to_page(xdpf->data)) +
+			sizeof(*xdpf) + xdpf->headroom - TX_WU_HEADER_LEN;
+		dma_sync_single_for_device(lp->dmadev, as[0], len[0],
+					   DMA_BIDIRECTIONAL);
+	}
+	len[1] = pad_length;
+	as[1] = lp->tx_pad_dma;
+
+	/* Reserve descriptors */
+	if (atomic_add_return(nr_descs, &lp->tx_count) >
+	    adi_msp_txq_num_tds(lp, ADI_MSP_TXQ_NONPTP)) {
+		atomic_sub(nr_descs, &lp->tx_count);
+		if (dma_map)
+			dma_unmap_single(lp->dmadev, as[0], len[0],
+					 DMA_TO_DEVICE);
+		put_frame_tag(lp, tag, false);
+		return -ENOSPC;
+	}
+	idx = atomic_fetch_add(nr_descs, &lp->tx_next_use) & ADI_MSP_TDS_MASK(lp);
+
+	for (i = 0; i < nr_descs; i++) {
+		next = (idx + i) & ADI_MSP_TDS_MASK(lp);
+		td = &lp->td_ring[next];
+
+		if (i > 0)
+			lp->td_ring[(next - 1) & ADI_MSP_TDS_MASK(lp)].dscptr_nxt =
+				adi_msp_tx_dma(lp, next);
+		adi_msp_fill_tx_desc(td, as[i], len[i], i == nr_descs - 1);
+		lp->tx_buf[next].dma = as[i];
+		lp->tx_buf[next].dma_len = (i == 0 && dma_map) ? len[i] : 0;
+	}
+
+	lp->tx_buf[idx].xdpf = xdpf;
+	lp->tx_buf[idx].descs = nr_descs;
+	/* Latency is only collected for frames of the stack */
+	if (lp->tx_time)
+		lp->tx_time[idx].xmit = 0;
+
+	/* Publish the filled frame to adi_msp_tx_kick_locked() */
+	smp_store_release(&lp->tx_buf[idx].pending, nr_descs);
+
+	/* Don't let the stack find the ring full, see adi_msp_xmit() */
+	if (!adi_msp_txq_has_room(lp, ADI_MSP_TXQ_NONPTP)) {
+		netif_tx_stop_queue(txq);
+		smp_mb();
+		if (adi_msp_txq_has_room(lp, ADI_MSP_TXQ_NONPTP))
+			netif_tx_wake_queue(txq);
+	}
+
+	return 0;
+}
+
+static void adi_msp_tx_kick(struct adi_msp_private *lp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	adi_msp_tx_kick_locked(lp);
+	spin_unlock_irqrestore(&lp->lock, flags);
+}
+
+/* Copy the frame on a buffer of AF_XDP socket into a page of its own.
+ * xdp_convert_zc_to_xdp_frame() does the same, but leaves no headroom for
+ * the work unit header.
+ */
+static struct xdp_frame *adi_msp_xsk_to_frame(struct xdp_buff *xdp)
+{
+	u32 len = (u8 *)xdp->data_end - (u8 *)xdp->data;
+	struct xdp_frame *xdpf;
+	struct page *page;
+	u8 *addr;
+
+	if (sizeof(*xdpf) + XDP_PACKET_HEADROOM + len > PAGE_SIZE)
+		return NULL;
+
+	page = dev_alloc_page();
+	if (unlikely(!page))
+		return NULL;
+
+	addr = page_address(page);
+	xdpf = (struct xdp_frame *)addr;
+	memset(xdpf, 0, sizeof(*xdpf));
+	xdpf->data = addr + sizeof(*xdpf) + XDP_PACKET_HEADROOM;
+	memcpy(xdpf->data, xdp->data, len);
+	xdpf->len = len;
+	xdpf->headroom = XDP_PACKET_HEADROOM;
+	xdpf->frame_sz = PAGE_SIZE;
+	xdpf->mem.type = MEM_TYPE_PAGE_ORDER0;
+
+	return xdpf;
+}
+
+/* Send the frame of XDP_TX verdict back on this port. A frame on a buffer
+ * of AF_XDP socket is sent from a copy, and the caller still owns the
+ * buffer.
+ */
+static int adi_msp_xdp_tx(struct adi_msp_private *lp, struct xdp_buff *xdp)
+{
+	struct netdev_queue *txq =
+		netdev_get_tx_queue(lp->dev, ADI_MSP_TXQ_NONPTP);
+	bool zc = xdp->rxq->mem.type == MEM_TYPE_XSK_BUFF_POOL;
+	struct xdp_frame *xdpf;
+	int ret;
+
+	if (zc)
+		xdpf = adi_msp_xsk_to_frame(xdp);
+	else
+		xdpf = xdp_convert_buff_to_frame(xdp);
+	if (unlikely(!xdpf))
+		return -EOVERFLOW;
+
+	/* The copy is not on a page of Rx page pool, so it's mapped */
+	__netif_tx_lock(txq, smp_processor_id());
+	ret = adi_msp_xdp_xmit_frame(lp, xdpf, zc);
+	__netif_tx_unlock(txq);
+
+	if (unlikely(ret) && zc)
+		xdp_return_frame(xdpf);
+
+	return ret;
+}
+
+/* Frames that cannot be sent are freed here and not counted in the return
+ * value.
+ */
+static int adi_msp_xdp_xmit(struct net_device *dev, int n,
+			    struct xdp_frame **frames, u32 flags)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, ADI_MSP_TXQ_NONPTP);
+	int i, drops = 0;
 
-	lp->tx_skb[idx] = skb;
+	if (unlikely(!netif_running(dev)))
+		return -ENETDOWN;
 
-	/* setup the transmit DMA descriptor(s). */
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
 
-	msize = min(__builtin_ctz(as), 3);
-	xmod = 1 << msize;
+	__netif_tx_lock(txq, smp_processor_id());
+	/* Tx rings are being rebuilt, see adi_msp_tx_reset_work() */
+	if (unlikely(READ_ONCE(lp->tx_resetting))) {
+		__netif_tx_unlock(txq);
+		return -ENETDOWN;
+	}
+	for (i = 0; i < n; i++) {
+		if (unlikely(adi_msp_xdp_xmit_frame(lp, frames[i], true))) {
+			MSP_DBG("%s: cannot send XDP frame, drop it\n", dev->name);
+			xdp_return_frame_rx_napi(frames[i]);
+			drops++;
+		}
+	}
+	lp->stats.xdp.xmit += n - drops;
+	lp->stats.xdp.xmit_errors += drops;
 
-	lp->tx_skb_dma[idx] = as;
-	td->addrstart = as;
-	td->cfg = TX_DMA_CFG_COMMON | DMA_CFG_FLOW_STOP | msize << 8;
-	td->xcnt = (wu_length + xmod - 1) / xmod;
-	td->xmod = xmod;
+	/* Kick with Tx queue lock held, so netif_tx_disable() waits for it */
+	if (flags & XDP_XMIT_FLUSH)
+		adi_msp_tx_kick(lp);
+	__netif_tx_unlock(txq);
 
-	chain_prev = (idx - 1) & ADI_MSP_TDS_MASK;
-	chain_next = (idx + 1) & ADI_MSP_TDS_MASK;
+	return n - drops;
+}
 
-	dma_stat = readl(&lp->tx_dma_regs->stat);
-	if (DMA_STAT_RUN(dma_stat) == DMA_STAT_HALT) {
-		if (lp->tx_chain_status == EMPTY) {
-			MSP_DBG("%s: DMA is halted and chain is empty, just start DMA on this one: %d\n",
-				dev->name, lp->tx_chain_head);
+/* Send at most BUDGET frames from Tx ring of AF_XDP socket. Frames are
+ * sent from UMEM without copying. Their work unit headers are put in the
+ * bounce buffers of their first descriptors. Like other XDP frames, they
+ * go on non-PTP Tx queue. Called from Tx status NAPI. Returns false if the
+ * budget is used up before the socket runs out of frames. A full Tx ring
+ * is left to the completions, which bring Tx status NAPI back.
+ */
+static bool adi_msp_xsk_xmit(struct adi_msp_private *lp, int budget)
+{
+	struct netdev_queue *txq =
+		netdev_get_tx_queue(lp->dev, ADI_MSP_TXQ_NONPTP);
+	struct xsk_buff_pool *pool = lp->xsk_pool;
+	struct tx_wu_header *hdr;
+	struct xdp_desc desc;
+	struct dma_desc *td;
+	dma_addr_t as[3]; // addrstart
+	u32 len[3];
+	u32 frame_length, wu_length, pad_length;
+	int nr_descs, idx, next, i, sent = 0;
+	u8 tag;
+
+	__netif_tx_lock(txq, smp_processor_id());
+
+	while (sent < budget) {
+		/* A descriptor taken from the socket cannot be given back,
+		 * so a frame tag and the most descriptors a frame can use
+		 * are reserved first
+		 */
+		tag = get_frame_tag(lp, false);
+		if (!tag)
+			break;
+		if (atomic_add_return(ARRAY_SIZE(as), &lp->tx_count) >
+		    adi_msp_txq_num_tds(lp, ADI_MSP_TXQ_NONPTP)) {
+			atomic_sub(ARRAY_SIZE(as), &lp->tx_count);
+			put_frame_tag(lp, tag, false);
+			break;
+		}
+		if (!xsk_tx_peek_desc(pool, &desc)) {
+			atomic_sub(ARRAY_SIZE(as), &lp->tx_count);
+			put_frame_tag(lp, tag, false);
+			break;
+		}
 
-			/* Move tail */
-			lp->tx_chain_tail = chain_next;
+#ifdef CONFIG_ADI_MSP_TX_PADDING
+		frame_length = max_t(u32, desc.len, TX_MIN_FRAME_SIZE);
+#else
+		frame_length = desc.len;
+#endif
 
-			/* Start DMA */
-			writel(adi_msp_tx_dma(lp, lp->tx_chain_head),
-			       &lp->tx_dma_regs->dscptr_nxt);
-			writel(TX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
-			       &lp->tx_dma_regs->cfg);
+#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
+		wu_length = round_up(frame_length + TX_WU_HEADER_LEN, 8);
+#else
+		wu_length = frame_length + TX_WU_HEADER_LEN;
+#endif
 
-			/* Move head to tail */
-			lp->tx_chain_head = lp->tx_chain_tail;
-		} else {
-			MSP_DBG("%s: DMA is halted and chain is filled, link in td and start DMA from chain head %d\n",
-				dev->name, lp->tx_chain_head);
+		pad_length = wu_length - (desc.len + TX_WU_HEADER_LEN);
+		nr_descs = pad_length ? 3 : 2;
+		atomic_sub(ARRAY_SIZE(as) - nr_descs, &lp->tx_count);
+
+		idx = atomic_fetch_add(nr_descs, &lp->tx_next_use) &
+		      ADI_MSP_TDS_MASK(lp);
+
+		hdr = (struct tx_wu_header *)adi_msp_tx_bounce(lp, idx);
+		hdr->byte0 = WU_TYPE_TX_DATA_SOF | adi_msp_tx_wu_port(lp->port);
+		hdr->frame_tag = tag;
+		hdr->frame_len = frame_length;
+
+		as[0] = adi_msp_tx_bounce_dma(lp, idx);
+		len[0] = TX_WU_HEADER_LEN;
+		as[1] = xsk_buff_raw_get_dma(pool, desc.addr);
+		len[1] = desc.len;
+		xsk_buff_raw_dma_sync_for_device(pool, as[1], desc.len);
+		as[2] = lp->tx_pad_dma;
+		len[2] = pad_length;
+
+		for (i = 0; i < nr_descs; i++) {
+			next = (idx + i) & ADI_MSP_TDS_MASK(lp);
+			td = &lp->td_ring[next];
+
+			if (i > 0)
+				lp->td_ring[(next - 1) & ADI_MSP_TDS_MASK(lp)].dscptr_nxt =
+					adi_msp_tx_dma(lp, next);
+			adi_msp_fill_tx_desc(td, as[i], len[i],
+					     i == nr_descs - 1);
+			lp->tx_buf[next].dma = as[i];
+			/* UMEM is mapped as long as the socket is bound */
+			lp->tx_buf[next].dma_len = 0;
+		}
 
-			/* Link to prev */
-			lp->td_ring[chain_prev].cfg |= DMA_CFG_FLOW_DSCL;
-			lp->td_ring[chain_prev].dscptr_nxt = adi_msp_tx_dma(lp, idx);
+		lp->tx_buf[idx].xsk = true;
+		lp->tx_buf[idx].bounced = true;
+		lp->tx_buf[idx].descs = nr_descs;
+		/* Latency is only collected for frames of the stack */
+		if (lp->tx_time)
+			lp->tx_time[idx].xmit = 0;
 
-			/* Move tail */
-			lp->tx_chain_tail = chain_next;
+		/* Publish the filled frame to adi_msp_tx_kick_locked() */
+		smp_store_release(&lp->tx_buf[idx].pending, nr_descs);
+		sent++;
+	}
 
-			/* Start DMA */
-			writel(adi_msp_tx_dma(lp, lp->tx_chain_head),
-			       &lp->tx_dma_regs->dscptr_nxt);
-			writel(TX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
-			       &lp->tx_dma_regs->cfg);
+	if (sent) {
+		xsk_tx_release(pool);
+		lp->stats.xdp.xsk_xmit += sent;
 
-			/* Move head to tail */
-			lp->tx_chain_head = lp->tx_chain_tail;
-			lp->tx_chain_status = EMPTY;
+		/* Don't let the stack find the ring full, see adi_msp_xmit() */
+		if (!adi_msp_txq_has_room(lp, ADI_MSP_TXQ_NONPTP)) {
+			netif_tx_stop_queue(txq);
+			smp_mb();
+			if (adi_msp_txq_has_room(lp, ADI_MSP_TXQ_NONPTP))
+				netif_tx_wake_queue(txq);
 		}
-	} else {
-		if (lp->tx_chain_status == EMPTY) {
-			MSP_DBG("%s: DMA is running and chain is empty, create a new chain, head %d\n",
-				dev->name, lp->tx_chain_head);
 
-			/* Move tail */
-			lp->tx_chain_tail = chain_next;
+		adi_msp_tx_kick(lp);
+	}
 
-			lp->tx_chain_status = FILLED;
-		} else {
-			MSP_DBG("%s: DMA is running and chain is filled, link in td\n", dev->name);
+	__netif_tx_unlock(txq);
 
-			/* Link to prev */
-			lp->td_ring[chain_prev].cfg |= DMA_CFG_FLOW_DSCL;
-			lp->td_ring[chain_prev].dscptr_nxt = adi_msp_tx_dma(lp, idx);
+	/* Socket has to wake Tx status NAPI up for new frames, see
+	 * adi_msp_xsk_wakeup()
+	 */
+	if (xsk_uses_need_wakeup(pool))
+		xsk_set_tx_need_wakeup(pool);
 
-			/* Move tail */
-			lp->tx_chain_tail = chain_next;
-		}
-	}
+	return sent < budget;
+}
 
-	netif_trans_update(dev);
+/* ndo_xsk_wakeup. Rx buffers are taken from the fill ring on each refill,
+ * so Rx only needs a poll if it's idle. Tx frames are sent by Tx status
+ * NAPI.
+ */
+static int adi_msp_xsk_wakeup(struct net_device *dev, u32 qid, u32 flags)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
 
-	spin_unlock_irqrestore(&lp->lock, flags);
+	if (unlikely(!netif_running(dev) || !lp->opened))
+		return -ENETDOWN;
 
-	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
-	return NETDEV_TX_OK;
+	if (unlikely(qid != 0 || !lp->xsk_pool))
+		return -ENXIO;
 
-drop_packet:
-	MSP_DBG("%s: drop the packet\n", dev->name);
-	lp->stats.nl.tx_dropped++;
-	dev_kfree_skb_any(skb);
-	spin_unlock_irqrestore(&lp->lock, flags);
+	/* Runs in process context. Let the softirq run when BH is enabled
+	 * again, instead of waiting for the next interrupt.
+	 */
+	local_bh_disable();
+	if (flags & XDP_WAKEUP_TX)
+		napi_schedule(&lp->status_napi);
+	if (flags & XDP_WAKEUP_RX)
+		napi_schedule(&lp->rx_napi);
+	local_bh_enable();
 
-	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
-	return NETDEV_TX_OK;
+	return 0;
 }
 
 /* TODO  We need an interrupt handler to count dropped frames and CRC errors */
@@ -1101,8 +2346,14 @@ static irqreturn_t adi_msp_rx_dma_done_interrupt(int irq, void *dev_id)
 
 	rx_dma_done_interrupt_count++;
 
+	trace_adi_msp_rx_irq(dev);
+
+	/* Mask it even if NAPI cannot be scheduled, e.g. a socket is busy
+	 * polling it. It's unmasked when NAPI completes.
+	 */
+	adi_msp_disable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
 	if (napi_schedule_prep(&lp->rx_napi)) {
-		adi_msp_disable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+		lp->rx_irq_time = adi_msp_lat_time();
 		__napi_schedule(&lp->rx_napi);
 	}
 
@@ -1136,75 +2387,424 @@ static irqreturn_t adi_msp_rx_dma_error_interrupt(int irq, void *dev_id)
 #define BYTES_PER_LINE	16
 #define FIRST_LINE_NUM	5
 #define LAST_LINE_NUM	5
-static void adi_msp_dump_prev_rx_skb(struct net_device *dev)
+static void adi_msp_dump_rx_wu(struct net_device *dev, int i, const u8 *wu)
+{
+	int header_type = wu[0] & WU_TYPE_MASK;
+	bool is_sof = (wu[0] & 0x4) != 0;
+	bool is_err = is_sof;
+	const char *header_type_str;
+	int total_lines;
+	int j, k;
+
+	if (header_type == WU_TYPE_RX_DATA) {
+		if (is_sof)
+			header_type_str = "SOF data work unit";
+		else
+			header_type_str = "non-SOF data work unit";
+	} else if (header_type == WU_TYPE_RX_STAT) {
+		if (is_err)
+			header_type_str = "status work unit (ERR = 1)";
+		else
+			header_type_str = "status work unit (ERR = 0)";
+	} else {
+		header_type_str = "UNKNOWN type work unit";
+	}
+
+	if (header_type != WU_TYPE_RX_STAT)
+		total_lines = (RX_WU_LEN + BYTES_PER_LINE - 1)
+				/ BYTES_PER_LINE;
+	else
+		total_lines = 1;
+
+	MSP_DBG("%s: prev_rx_page[%d] %s\n", dev->name, i, header_type_str);
+	for (j = 0; j < total_lines; j++) {
+		char buf[3 * BYTES_PER_LINE + 1];
+
+		if (j >= FIRST_LINE_NUM &&
+		    j < total_lines - LAST_LINE_NUM)
+			continue;
+
+		buf[0] = '\0';
+		for (k = 0; k < BYTES_PER_LINE; k++)
+			sprintf(buf + strlen(buf), " %02x",
+				wu[j * BYTES_PER_LINE + k]);
+		MSP_DBG("%s: %8x:%s\n", dev->name, j * BYTES_PER_LINE, buf);
+	}
+}
+
+/* Work unit of the I-th previous data work unit */
+static u8 *adi_msp_rx_prev_wu(struct adi_msp_private *lp, int i)
+{
+	if (lp->prev_rx_xsk[i])
+		return lp->prev_rx_xsk[i]->data;
+	return adi_msp_rx_page_wu(lp->prev_rx_page[i]);
+}
+
+/* DMA address of the I-th previous data work unit */
+static dma_addr_t adi_msp_rx_prev_dma(struct adi_msp_private *lp, int i)
+{
+	if (lp->prev_rx_xsk[i])
+		return xsk_buff_xdp_get_dma(lp->prev_rx_xsk[i]);
+	return page_pool_get_dma_addr(lp->prev_rx_page[i]) + RX_WU_HEADROOM;
+}
+
+/* Where the frame offset in the first previous data work unit counts from,
+ * the start of the page or data_hard_start of the AF_XDP buffer
+ */
+static u8 *adi_msp_rx_prev_base(struct adi_msp_private *lp)
+{
+	if (lp->prev_rx_xsk[0])
+		return lp->prev_rx_xsk[0]->data_hard_start;
+	return page_address(lp->prev_rx_page[0]);
+}
+
+/* Whether any previous data work unit is on a buffer of AF_XDP socket */
+static bool adi_msp_rx_prev_xsk(struct adi_msp_private *lp)
+{
+	int i;
+
+	if (!lp->xsk_pool)
+		return false;
+
+	for (i = 0; i < lp->prev_rx_page_count; i++)
+		if (lp->prev_rx_xsk[i])
+			return true;
+
+	return false;
+}
+
+/* Keep the buffer of a data work unit until the status work unit arrives */
+static void adi_msp_rx_keep(struct adi_msp_private *lp,
+			    const struct adi_msp_rx_buf *rb)
+{
+	int i = lp->prev_rx_page_count++;
+
+	lp->prev_rx_page[i] = rb->xsk ? NULL : rb->page;
+	lp->prev_rx_xsk[i] = rb->xsk ? rb->xdp : NULL;
+}
+
+/* Dump the previous work units and then WU, which is the current one being
+ * processed in place, if it's not NULL.
+ */
+static void adi_msp_dump_prev_rx_page(struct net_device *dev, const u8 *wu)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
-	int i, j, k;
-
-	/* dump the first and last two bytes of the SKB buffer */
-	for (i = 0; i < lp->prev_rx_skb_count; i++) {
-		int header_type = lp->prev_rx_skb[i]->data[0] & WU_TYPE_MASK;
-		bool is_sof = (lp->prev_rx_skb[i]->data[0] & 0x4) != 0;
-		bool is_err = is_sof;
-		const char *header_type_str;
-		int total_lines;
-
-		if (header_type == WU_TYPE_RX_DATA) {
-			if (is_sof)
-				header_type_str = "SOF data work unit";
-			else
-				header_type_str = "non-SOF data work unit";
-		} else if (header_type == WU_TYPE_RX_STAT) {
-			if (is_err)
-				header_type_str = "status work unit (ERR = 1)";
-			else
-				header_type_str = "status work unit (ERR = 0)";
-		} else {
-			header_type_str = "UNKNOWN type work unit";
-		}
+	int i;
 
-		if (header_type != WU_TYPE_RX_STAT)
-			total_lines = (RX_WU_LEN + BYTES_PER_LINE - 1)
-					/ BYTES_PER_LINE;
-		else
-			total_lines = 1;
+	/* dump the first and last two bytes of the work unit buffer */
+	for (i = 0; i < lp->prev_rx_page_count; i++)
+		adi_msp_dump_rx_wu(dev, i, adi_msp_rx_prev_wu(lp, i));
 
-		MSP_DBG("%s: prev_rx_skb[%d] %s\n", dev->name, i, header_type_str);
-		for (j = 0; j < total_lines; j++) {
-			char buf[3 * BYTES_PER_LINE + 1];
+	if (wu)
+		adi_msp_dump_rx_wu(dev, i, wu);
+}
 
-			if (j >= FIRST_LINE_NUM &&
-			    j < total_lines - LAST_LINE_NUM)
-				continue;
+/* Give pages of the previous work units back to the page pool, and
+ * buffers of AF_XDP socket back to its pool
+ */
+static void adi_msp_recycle_prev_rx_page(struct adi_msp_private *lp)
+{
+	int i;
 
-			buf[0] = '\0';
-			for (k = 0; k < BYTES_PER_LINE; k++)
-				sprintf(buf + strlen(buf), " %02x",
-					lp->prev_rx_skb[i]->data[j * BYTES_PER_LINE + k]);
-			MSP_DBG("%s: %8x:%s\n", dev->name, j * BYTES_PER_LINE, buf);
-		}
+	for (i = 0; i < lp->prev_rx_page_count; i++) {
+		if (lp->prev_rx_xsk[i])
+			xsk_buff_free(lp->prev_rx_xsk[i]);
+		else
+			page_pool_recycle_direct(lp->rx_page_pool,
+						 lp->prev_rx_page[i]);
+		lp->prev_rx_page[i] = NULL;
+		lp->prev_rx_xsk[i] = NULL;
 	}
+	lp->prev_rx_page_count = 0;
 }
 
-static void adi_msp_drop_prev_rx_skb(struct net_device *dev, int budget)
+static void adi_msp_drop_prev_rx_page(struct net_device *dev)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
+
+	MSP_DBG("%s: drop %d work units\n", dev->name, lp->prev_rx_page_count);
+	adi_msp_recycle_prev_rx_page(lp);
+}
+
+/* Sync the frame data in previous data work units for CPU. Only their
+ * headers have been synced when the work units were checked.
+ */
+static void adi_msp_rx_sync_prev_page(struct adi_msp_private *lp, u32 pkt_len)
+{
+	u32 len;
+	int i;
+
+	for (i = 0; i < lp->prev_rx_page_count; i++) {
+		len = min_t(u32, pkt_len, RX_WU_DATA_LEN);
+		dma_sync_single_for_cpu(lp->dmadev, adi_msp_rx_prev_dma(lp, i),
+					RX_DATA_WU_HEADER_LEN + len,
+					DMA_BIDIRECTIONAL);
+		pkt_len -= len;
+	}
+}
+
+/* Build SKB on the pages of previous data work units. The first page holds
+ * the head of SKB, the others are attached as page fragments. So the frame
+ * is never copied. The pages leave the page pool and will be freed by the
+ * network stack.
+ *
+ * The frame starts at OFFSET of the first page, which XDP program might
+ * have moved, and has PKT_LEN bytes in total.
+ *
+ * On failure the pages are left in prev_rx_page[].
+ */
+static struct sk_buff *adi_msp_rx_build_skb(struct adi_msp_private *lp,
+					    u32 offset, u32 pkt_len)
+{
+	struct sk_buff *skb;
+	struct page *page;
+	u32 len;
+	int i;
+
+	BUILD_BUG_ON(RX_WU_HEADROOM + RX_WU_LEN +
+		     SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) > PAGE_SIZE);
+
+	page = lp->prev_rx_page[0];
+	skb = build_skb(page_address(page), PAGE_SIZE);
+	if (unlikely(!skb))
+		return NULL;
+
+	page_pool_release_page(lp->rx_page_pool, page);
+
+	/* Remove work unit header */
+	len = lp->prev_rx_page_count == 1 ? pkt_len : RX_WU_DATA_LEN;
+	skb_reserve(skb, offset);
+	skb_put(skb, len);
+	pkt_len -= len;
+
+	for (i = 1; i < lp->prev_rx_page_count; i++) {
+		page = lp->prev_rx_page[i];
+		len = min_t(u32, pkt_len, RX_WU_DATA_LEN);
+
+		page_pool_release_page(lp->rx_page_pool, page);
+		skb_add_rx_frag(skb, i - 1, page,
+				RX_WU_HEADROOM + RX_DATA_WU_HEADER_LEN, len,
+				PAGE_SIZE);
+		pkt_len -= len;
+	}
+
+	for (i = 0; i < lp->prev_rx_page_count; i++)
+		lp->prev_rx_page[i] = NULL;
+	lp->prev_rx_page_count = 0;
+
+	return skb;
+}
+
+/* Copy the frame in previous data work units into a new SKB. The pages are
+ * recycled into the page pool directly. They're still mapped, so the next
+ * refills take them without allocation or remapping. Buffers of AF_XDP
+ * socket go back to its pool, since they always belong to user space.
+ *
+ * OFFSET is from the start of the first page, or data_hard_start of the
+ * first AF_XDP buffer. Only frames in one work unit can be moved by XDP.
+ *
+ * On failure the buffers are left in prev_rx_page[] and prev_rx_xsk[].
+ */
+static struct sk_buff *adi_msp_rx_copy_skb(struct adi_msp_private *lp,
+					   u32 offset, u32 pkt_len)
+{
+	struct sk_buff *skb;
+	u32 len;
 	int i;
 
-	MSP_DBG("%s: drop %d work units\n", dev->name, lp->prev_rx_skb_count);
-	for (i = 0; i < lp->prev_rx_skb_count; i++) {
-		napi_consume_skb(lp->prev_rx_skb[i], budget);
-		lp->prev_rx_skb[i] = NULL;
+	skb = napi_alloc_skb(&lp->rx_napi, pkt_len);
+	if (unlikely(!skb))
+		return NULL;
+
+	len = lp->prev_rx_page_count == 1 ? pkt_len : RX_WU_DATA_LEN;
+	skb_put_data(skb, adi_msp_rx_prev_base(lp) + offset, len);
+	pkt_len -= len;
+
+	for (i = 1; i < lp->prev_rx_page_count; i++) {
+		len = min_t(u32, pkt_len, RX_WU_DATA_LEN);
+		skb_put_data(skb, adi_msp_rx_prev_wu(lp, i) +
+			     RX_DATA_WU_HEADER_LEN, len);
+		pkt_len -= len;
+	}
+
+	adi_msp_recycle_prev_rx_page(lp);
+
+	return skb;
+}
+
+static inline u16 adi_msp_get_be16(const u8 *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+/* Tell whether the frame of LEN bytes at DATA is a PTPv2 event message over
+ * one of the transports in PTP (ADI_MSP_PTP_*). It looks into the data work
+ * unit directly, so frames which need no timestamp don't take the timestamp
+ * path. The frame data may be unaligned, so it's read byte by byte.
+ */
+static bool adi_msp_rx_is_ptp_event(const u8 *data, u32 len, u8 ptp)
+{
+	const u8 *end = data + len;
+	const u8 *p = data + ETH_HLEN;
+	const struct iphdr *iph;
+	u16 proto;
+
+	if (len < ETH_HLEN)
+		return false;
+
+	proto = adi_msp_get_be16(data + 2 * ETH_ALEN);
+	if (proto == ETH_P_8021Q) {
+		if (p + VLAN_HLEN > end)
+			return false;
+		proto = adi_msp_get_be16(p + 2);
+		p += VLAN_HLEN;
+	}
+
+	switch (proto) {
+	case ETH_P_1588:
+		if (!(ptp & ADI_MSP_PTP_L2))
+			return false;
+		break;
+	case ETH_P_IP:
+		if (!(ptp & ADI_MSP_PTP_L4) || p + sizeof(*iph) > end)
+			return false;
+		iph = (const struct iphdr *)p;
+		/* Only the first fragment has UDP header */
+		if (iph->protocol != IPPROTO_UDP ||
+		    adi_msp_get_be16(p + offsetof(struct iphdr, frag_off)) &
+		    IP_OFFSET)
+			return false;
+		p += iph->ihl * 4;
+		goto udp;
+	case ETH_P_IPV6:
+		if (!(ptp & ADI_MSP_PTP_L4) || p + sizeof(struct ipv6hdr) > end)
+			return false;
+		if (((const struct ipv6hdr *)p)->nexthdr != IPPROTO_UDP)
+			return false;
+		p += sizeof(struct ipv6hdr);
+udp:
+		if (p + sizeof(struct udphdr) > end ||
+		    adi_msp_get_be16(p + offsetof(struct udphdr, dest)) !=
+		    PTP_EV_PORT)
+			return false;
+		p += sizeof(struct udphdr);
+		break;
+	default:
+		return false;
+	}
+
+	/* Low nibbles of the first two bytes of PTP header are messageType
+	 * and versionPTP. Event messages are Sync, Delay_Req, Pdelay_Req and
+	 * Pdelay_Resp, i.e. message types 0 to 3.
+	 */
+	if (p + 2 > end)
+		return false;
+
+	return (p[1] & 0x0f) == 2 && (p[0] & 0x0f) <= 3;
+}
+
+/* Run XDP program on the frame in the only previous data work unit. The
+ * frame starts at OFFSET of the page, or of data_hard_start of the AF_XDP
+ * buffer, and has PKT_LEN bytes. On XDP_PASS, both are updated to what the
+ * program has left, and the buffer is kept in prev_rx_page[] or
+ * prev_rx_xsk[]. Otherwise the buffer has been consumed. Failed XDP_TX and
+ * XDP_REDIRECT are turned into XDP_DROP.
+ *
+ * An AF_XDP buffer comes with its own xdp_buff, whose rxq is xsk_rxq. So
+ * XDP_REDIRECT into the socket hands the buffer over without copying.
+ */
+static u32 adi_msp_rx_xdp(struct adi_msp_private *lp, struct bpf_prog *prog,
+			  u32 *offset, u32 *pkt_len)
+{
+	struct xdp_buff *xsk = lp->prev_rx_xsk[0];
+	struct page *page = lp->prev_rx_page[0];
+	struct xdp_buff xdp_page, *xdp = xsk;
+	u32 act;
+
+	if (!xsk) {
+		xdp = &xdp_page;
+		xdp->data_hard_start = page_address(page);
+		xdp->rxq = &lp->xdp_rxq;
+		xdp->frame_sz = PAGE_SIZE;
+	}
+	xdp->data = (u8 *)xdp->data_hard_start + *offset;
+	xdp->data_end = (u8 *)xdp->data + *pkt_len;
+	xdp_set_data_meta_invalid(xdp);
+
+	act = bpf_prog_run_xdp(prog, xdp);
+	switch (act) {
+	case XDP_PASS:
+		*offset = (u8 *)xdp->data - (u8 *)xdp->data_hard_start;
+		*pkt_len = (u8 *)xdp->data_end - (u8 *)xdp->data;
+		lp->stats.xdp.rx_pass++;
+		return act;
+	case XDP_TX:
+		if (unlikely(adi_msp_xdp_tx(lp, xdp)))
+			goto xdp_failure;
+		if (xsk)
+			xsk_buff_free(xsk);
+		lp->stats.xdp.rx_tx++;
+		break;
+	case XDP_REDIRECT:
+		if (unlikely(xdp_do_redirect(lp->dev, xdp, prog)))
+			goto xdp_failure;
+		lp->stats.xdp.rx_redirect++;
+		break;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+		fallthrough;
+	case XDP_ABORTED:
+xdp_failure:
+		trace_xdp_exception(lp->dev, prog, act);
+		lp->stats.xdp.rx_aborted++;
+		fallthrough;
+	case XDP_DROP:
+		if (xsk)
+			xsk_buff_free(xsk);
+		else
+			page_pool_recycle_direct(lp->rx_page_pool, page);
+		lp->stats.xdp.rx_drop++;
+		act = XDP_DROP;
+		break;
+	}
+
+	lp->prev_rx_page[0] = NULL;
+	lp->prev_rx_xsk[0] = NULL;
+	lp->prev_rx_page_count = 0;
+
+	return act;
+}
+
+/* Account the latency of SKB from Rx DMA done interrupt to being passed to
+ * the stack
+ */
+static void adi_msp_rx_lat_done(struct adi_msp_private *lp,
+				struct net_device *rx_dev, struct sk_buff *skb)
+{
+	u64 irq_to_receive = 0;
+
+	if (lp->rx_irq_time) {
+		irq_to_receive = ktime_to_ns(ktime_sub(ktime_get(),
+						       lp->rx_irq_time));
+		adi_msp_lat_sync(READ_ONCE(lp->lat_clear_gen), &lp->rx_lat_gen,
+				 &lp->rx_lat, sizeof(lp->rx_lat));
+		adi_msp_lat_add(&lp->rx_lat, irq_to_receive);
 	}
-	lp->prev_rx_skb_count = 0;
+
+	trace_adi_msp_rx_receive(rx_dev, skb, irq_to_receive);
 }
 
 static int adi_msp_rx(struct net_device *dev, int budget)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
 	struct dma_desc *rd = &lp->rd_ring[lp->rx_next_done];
+	struct bpf_prog *xdp_prog = READ_ONCE(lp->xdp_prog);
+	bool xdp_tx = false, xdp_redirect = false;
+	/* Errors before the status work unit tells the port */
+	struct adi_msp_ctx_stats *dev_rs = &lp->rx_stats[lp->port];
 	u32 dma_stat;
 	int count;
+	int done = 0;
 
 	MSP_DBG("%s: Entering %s ...\n", dev->name, __func__);
 
@@ -1214,254 +2814,328 @@ msp_rx_loop:
 
 	while (count < budget) {
 		int idx = lp->rx_next_done;
-		struct sk_buff *skb, *skb_new;
-		u32 addr_cur, dscptr_prv, addrstart;
+		struct adi_msp_rx_buf rb;
+		u8 *wu;
 		u32 chain_prev;
-		dma_addr_t as;
 
 		MSP_DBG("%s: count = %d idx = %d\n", dev->name, count, idx);
-		skb = lp->rx_skb[idx];
-		skb_new = NULL;
+		wu = adi_msp_rx_wu(lp, idx);
 
-		dma_sync_single_for_cpu(lp->dmadev, lp->rx_skb_dma[idx],
-					RX_WU_LEN, DMA_FROM_DEVICE);
+		/* The header and the status are enough to tell what this work
+		 * unit is. Frame data is synced when SKB is built.
+		 */
+		dma_sync_single_for_cpu(lp->dmadev, lp->rx_buf[idx].dma,
+					STATUS_WU_LEN, DMA_BIDIRECTIONAL);
 
-		MSP_DBG("%s: skb->data[0] = 0x%x\n", dev->name, skb->data[0]);
+		MSP_DBG("%s: wu[0] = 0x%x\n", dev->name, wu[0]);
 
 		/* If the first byte has not been written, this work unit has
 		 * not been started yet.
 		 */
-		if (skb->data[0] == 0) {
-			MSP_DBG("%s: skb->data[0] == 0  ==>  break\n", dev->name);
+		if (wu[0] == 0) {
+			MSP_DBG("%s: wu[0] == 0  ==>  break\n", dev->name);
 			break;
 		}
 
-		/* If skb->data[0] is not zero, this work unit has been
-		 * started. But if the current address is still in this work
-		 * unit and the initial descriptor address has not been
-		 * copied into the DSCPTR_PREV register, this work unit is
-		 * not done yet.
+		/* If wu[0] is not zero, this work unit has been
+		 * started. Read DMA registers only when it's past the work
+		 * units known to be done.
 		 */
-		addr_cur = readl(&lp->rx_dma_regs->addr_cur);
-		dscptr_prv = readl(&lp->rx_dma_regs->dscptr_prv);
-		dscptr_prv &= ~0x3;
-		addrstart = lp->rd_ring[idx].addrstart;
-		if (addr_cur >= addrstart &&
-		    addr_cur < addrstart + RX_WU_LEN &&
-		    dscptr_prv != adi_msp_rx_dma(lp, idx)) {
-			MSP_DBG("%s: skb not done by DMA  ==>  break\n", dev->name);
-			break;
-		}
-
-		/* Malloc up new buffer. */
-		skb_new = napi_alloc_skb(&lp->rx_napi, RX_WU_BUF_SIZE);
-		if (unlikely(!skb_new)) {
-			MSP_ERR("%s: cannot alloc new skb\n", dev->name);
-			break;
-		}
-
-		if (unlikely(((unsigned long long)skb_new->data) & 0x7)) {
-			MSP_ERR("%s: new skb data not aligned to 8\n", dev->name);
-			break;
-		}
-		/* Initialize the first byte of work unit header to 0 */
-		skb_new->data[0] = 0;
-
-		as = dma_map_single(lp->dmadev, skb_new->data, RX_WU_LEN,
-				    DMA_FROM_DEVICE);
-		if (unlikely(dma_mapping_error(lp->dmadev, as))) {
-			MSP_ERR("%s: dma map new skb failed\n", dev->name);
-			napi_consume_skb(skb_new, budget);
-			break;
+		if (done == 0) {
+			done = adi_msp_dma_done_count(lp->rx_dma_regs,
+						      lp->rd_ring, lp->rd_dma,
+						      ADI_MSP_RDS_MASK(lp), idx,
+						      RX_WU_LEN,
+						      &lp->rx_stale_dscptr);
+			MSP_DBG("%s: %d work unit(s) done by DMA\n", dev->name, done);
+			if (done == 0) {
+				MSP_DBG("%s: work unit not done by DMA  ==>  break\n", dev->name);
+				break;
+			}
 		}
 
-		dma_unmap_single(lp->dmadev, lp->rx_skb_dma[idx],
-				 RX_WU_LEN, DMA_FROM_DEVICE);
-
-		lp->rx_skb[idx] = skb_new;
-		lp->rx_skb_dma[idx] = as;
+		if ((wu[0] & WU_TYPE_MASK) == WU_TYPE_RX_DATA &&
+		    (wu[0] & RX_DATA_WU_HEADER_RESERVED_BITS) == 0) {
+			/* The page of data work unit is kept until the status
+			 * work unit arrives. Replace it with a new one.
+			 */
+			rb = lp->rx_buf[idx];
+			if (unlikely(adi_msp_rx_refill(lp, idx))) {
+				MSP_ERR("%s: cannot alloc new page\n", dev->name);
+				break;
+			}
 
-		if ((skb->data[0] & WU_TYPE_MASK) == WU_TYPE_RX_DATA &&
-		    (skb->data[0] & RX_DATA_WU_HEADER_RESERVED_BITS) == 0) {
-			if (likely((skb->data[0] & RX_DATA_WU_HEADER_SOF) != 0)) {
+			if (likely((wu[0] & RX_DATA_WU_HEADER_SOF) != 0)) {
 				/* this is start of frame work unit*/
 
-				if (unlikely(lp->prev_rx_skb_count > 0)) {
+				if (unlikely(lp->prev_rx_page_count > 0)) {
 					MSP_ERR("%s: unexpected SOF work unit, will drop previous %d work unit(s)\n",
-						dev->name, lp->prev_rx_skb_count);
+						dev->name, lp->prev_rx_page_count);
 
-					adi_msp_dump_prev_rx_skb(dev);
-					adi_msp_drop_prev_rx_skb(dev, budget);
+					adi_msp_dump_prev_rx_page(dev, NULL);
+					adi_msp_drop_prev_rx_page(dev);
 
-					lp->stats.nl.rx_errors++;
+					adi_msp_stats_inc(dev_rs, errors);
 				}
 
-				lp->prev_rx_skb[0] = skb;
-				lp->prev_rx_skb_count = 1;
+				adi_msp_rx_keep(lp, &rb);
 			} else {
-				if (unlikely(lp->prev_rx_skb_count == 0)) {
+				if (unlikely(lp->prev_rx_page_count == 0)) {
 					MSP_ERR("%s: non-SOF work unit does not follow an SOF work unit, will be dropped\n",
 						dev->name);
 
-					lp->prev_rx_skb[0] = skb;
-					lp->prev_rx_skb_count = 1;
+					adi_msp_rx_keep(lp, &rb);
 
-					adi_msp_dump_prev_rx_skb(dev);
-					adi_msp_drop_prev_rx_skb(dev, budget);
+					adi_msp_dump_prev_rx_page(dev, NULL);
+					adi_msp_drop_prev_rx_page(dev);
 
-					lp->stats.nl.rx_errors++;
-				} else if (unlikely(lp->prev_rx_skb_count == PREV_RX_SKB_NUM - 1)) {
+					adi_msp_stats_inc(dev_rs, errors);
+				} else if (unlikely(lp->prev_rx_page_count == PREV_RX_PAGE_NUM - 1)) {
 					MSP_ERR("%s: Ethernet frame uses too many work units, will be dropped\n",
 						dev->name);
-					lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-					lp->prev_rx_skb_count++;
+					adi_msp_rx_keep(lp, &rb);
 
-					adi_msp_dump_prev_rx_skb(dev);
-					adi_msp_drop_prev_rx_skb(dev, budget);
+					adi_msp_dump_prev_rx_page(dev, NULL);
+					adi_msp_drop_prev_rx_page(dev);
 
-					lp->stats.nl.rx_errors++;
+					adi_msp_stats_inc(dev_rs, errors);
 				} else {
-					lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-					lp->prev_rx_skb_count++;
+					adi_msp_rx_keep(lp, &rb);
 				}
 			}
-		} else if ((skb->data[0] & WU_TYPE_MASK) == WU_TYPE_RX_STAT &&
-			   (skb->data[0] & RX_STAT_WU_HEADER_RESERVED_BITS) == 0) {
+		} else if ((wu[0] & WU_TYPE_MASK) == WU_TYPE_RX_STAT &&
+			   (wu[0] & RX_STAT_WU_HEADER_RESERVED_BITS) == 0) {
+			int port = (wu[0] & RX_STAT_WU_HEADER_PORT) ? 1 : 0;
+			struct net_device *rx_dev;
+			struct adi_msp_ctx_stats *rs;
+
 			MSP_DBG("%s: ethernet frame received from port %d\n",
-				dev->name, (skb->data[0] & RX_STAT_WU_HEADER_PORT) ? 1 : 0);
+				dev->name, port);
 
-			if (unlikely((skb->data[0] & RX_STAT_WU_HEADER_DROPPED_ERR) != 0)) {
+			/* Frames of a port without netdev go to dev */
+			if (!lp->port_dev[port])
+				port = lp->port;
+			rx_dev = lp->port_dev[port];
+			rs = &lp->rx_stats[port];
+
+			if (unlikely((wu[0] & RX_STAT_WU_HEADER_DROPPED_ERR) != 0)) {
 				MSP_ERR("%s: status work unit indicates frame dropped error\n",
 					dev->name);
 
-				lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-				lp->prev_rx_skb_count++;
-
-				adi_msp_dump_prev_rx_skb(dev);
-				adi_msp_drop_prev_rx_skb(dev, budget);
+				adi_msp_dump_prev_rx_page(dev, wu);
+				adi_msp_drop_prev_rx_page(dev);
 
 				/* According to the spec, it can be a CRC error
 				 * or frame length error. But we don't know
 				 * which it is.
 				 */
-				lp->stats.nl.rx_errors++;
+				adi_msp_stats_inc(rs, errors);
 
 				count++;
-			} else if (unlikely((skb->data[0] & RX_STAT_WU_HEADER_ERR) != 0)) {
+			} else if (unlikely((wu[0] & RX_STAT_WU_HEADER_ERR) != 0)) {
 				MSP_ERR("%s: status work unit indicates error, will be dropped\n",
 					dev->name);
 
-				lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-				lp->prev_rx_skb_count++;
-
-				adi_msp_dump_prev_rx_skb(dev);
-				adi_msp_drop_prev_rx_skb(dev, budget);
+				adi_msp_dump_prev_rx_page(dev, wu);
+				adi_msp_drop_prev_rx_page(dev);
 
 				/* According to the spec, it can be a CRC error
 				 * or frame length error. But we don't know
 				 * which it is.
 				 */
-				lp->stats.nl.rx_errors++;
+				adi_msp_stats_inc(rs, errors);
 
 				count++;
-			} else if (unlikely(lp->prev_rx_skb_count == 0)) {
+			} else if (unlikely(lp->prev_rx_page_count == 0)) {
 				MSP_ERR("%s: status work unit does not follow data work unit(s), will be dropped\n",
 					dev->name);
 
-				lp->prev_rx_skb[0] = skb;
-				lp->prev_rx_skb_count = 1;
-
-				adi_msp_dump_prev_rx_skb(dev);
-				adi_msp_drop_prev_rx_skb(dev, budget);
+				adi_msp_dump_prev_rx_page(dev, wu);
 
-				lp->stats.nl.rx_errors++;
-			} else if (unlikely(lp->prev_rx_skb_count > DATA_WU_PER_FRAME)) {
+				adi_msp_stats_inc(rs, errors);
+			} else if (unlikely(lp->prev_rx_page_count > DATA_WU_PER_FRAME)) {
 				MSP_ERR("%s: Ethernet frame larger than MTU, will be dropped\n",
 					dev->name);
 
-				lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-				lp->prev_rx_skb_count++;
-
-				adi_msp_dump_prev_rx_skb(dev);
-				adi_msp_drop_prev_rx_skb(dev, budget);
+				adi_msp_dump_prev_rx_page(dev, wu);
+				adi_msp_drop_prev_rx_page(dev);
 
 				/* According to the spec, it can be a CRC error
 				 * or frame length error. But we don't know
 				 * which it is.
 				 */
-				lp->stats.nl.rx_errors++;
+				adi_msp_stats_inc(rs, errors);
+
+				count++;
+			} else if (unlikely(DIV_ROUND_UP(((union status_wu *)wu)->s.frame_len,
+						     RX_WU_DATA_LEN) !=
+					    lp->prev_rx_page_count)) {
+				MSP_ERR("%s: Ethernet frame length (%d) does not match %d data work unit(s), will be dropped\n",
+					dev->name, ((union status_wu *)wu)->s.frame_len,
+					lp->prev_rx_page_count);
+
+				adi_msp_dump_prev_rx_page(dev, wu);
+				adi_msp_drop_prev_rx_page(dev);
+
+				adi_msp_stats_inc(rs, length_errors);
+				adi_msp_stats_inc(rs, errors);
+
+				count++;
+			} else if (unlikely(!netif_running(rx_dev))) {
+				/* Netdev of the other port is down */
+				adi_msp_drop_prev_rx_page(dev);
+				adi_msp_stats_inc(rs, dropped);
 
 				count++;
 			} else {
-				/* TODO  support DATA_WU_PER_FRAME > 1 */
-				struct sk_buff *skb_prev;
+				struct sk_buff *skb;
 				union status_wu *status_wu;
-				u32 pkt_len;
+				u32 pkt_len, offset, data_len;
+				bool gro, ts;
 
 				MSP_DBG("%s: processing received ethernet frame data and status work units\n",
 					dev->name);
 
-				skb_prev = lp->prev_rx_skb[0];
-				lp->prev_rx_skb[0] = NULL;
-				lp->prev_rx_skb_count = 0;
-
-				status_wu = (union status_wu *)skb->data;
+				status_wu = (union status_wu *)wu;
 				pkt_len = status_wu->s.frame_len;
 
-				MSP_DBG("%s: Ethernet frame length = %d\n", dev->name, pkt_len);
+				MSP_DBG("%s: Ethernet frame length = %d in %d work unit(s)\n",
+					dev->name, pkt_len, lp->prev_rx_page_count);
+
+				adi_msp_rx_sync_prev_page(lp, pkt_len);
+
+				offset = adi_msp_rx_prev_wu(lp, 0) -
+					 adi_msp_rx_prev_base(lp) +
+					 RX_DATA_WU_HEADER_LEN;
+				data_len = pkt_len;
+
+				/* XDP program is only attached to dev */
+				if (xdp_prog && rx_dev == dev) {
+					u32 act;
+
+					/* Not expected, since MTU is limited
+					 * while XDP program is attached
+					 */
+					if (unlikely(lp->prev_rx_page_count > 1)) {
+						MSP_ERR("%s: frame in %d work units cannot be passed to XDP, will be dropped\n",
+							dev->name, lp->prev_rx_page_count);
+						adi_msp_drop_prev_rx_page(dev);
+						adi_msp_stats_inc(rs, dropped);
+						count++;
+						goto rearm_status_wu;
+					}
+
+					act = adi_msp_rx_xdp(lp, xdp_prog,
+							     &offset, &data_len);
+					if (act != XDP_PASS) {
+						if (act == XDP_TX)
+							xdp_tx = true;
+						else if (act == XDP_REDIRECT)
+							xdp_redirect = true;
+
+						adi_msp_stats_add_frame(rs, pkt_len);
+						count++;
+						goto rearm_status_wu;
+					}
+				}
+
+				/* GRO keeps only the timestamp of the first
+				 * merged frame. PTP event frames need their
+				 * own, and should not wait in GRO.
+				 */
+				gro = true;
+				ts = false;
+				if (unlikely(lp->hwtstamp_rx_filter != HWTSTAMP_FILTER_NONE)) {
+					u32 len = lp->prev_rx_page_count == 1 ?
+						  data_len : RX_WU_DATA_LEN;
+					u8 *data = adi_msp_rx_prev_base(lp) +
+						   offset;
+
+					gro = !adi_msp_rx_is_ptp_event(data, len,
+								       lp->hwtstamp_rx_ptp);
+					ts = !gro ||
+					     lp->hwtstamp_rx_filter == HWTSTAMP_FILTER_ALL;
+				}
 
-				if (unlikely(lp->hwtstamp_rx_en)) {
+				/* Buffers of AF_XDP socket are never given
+				 * to the stack
+				 */
+				if ((lp->prev_rx_page_count == 1 &&
+				     data_len < READ_ONCE(lp->rx_copybreak)) ||
+				    adi_msp_rx_prev_xsk(lp))
+					skb = adi_msp_rx_copy_skb(lp, offset,
+								  data_len);
+				else
+					skb = adi_msp_rx_build_skb(lp, offset,
+								   data_len);
+				if (unlikely(!skb)) {
+					MSP_ERR("%s: cannot build skb\n", dev->name);
+					adi_msp_drop_prev_rx_page(dev);
+					adi_msp_stats_inc(rs, dropped);
+					count++;
+					goto rearm_status_wu;
+				}
+
+				if (ts) {
 					struct skb_shared_hwtstamps *hwtstamps;
-					u64 ns = get_timestamp_ns(status_wu);
+					u64 ns = get_timestamp_ns(&lp->rx_ts_cache,
+								  status_wu);
 
 					MSP_DBG("%s: timestamp = %llu\n", dev->name, ns);
 
-					hwtstamps = skb_hwtstamps(skb_prev);
+					hwtstamps = skb_hwtstamps(skb);
 					memset(hwtstamps, 0, sizeof(*hwtstamps));
 					hwtstamps->hwtstamp = ns_to_ktime(ns);
 				}
 
-				napi_consume_skb(skb, budget);
+				skb->protocol = eth_type_trans(skb, rx_dev);
 
-				skb_put(skb_prev, pkt_len + RX_DATA_WU_HEADER_LEN);
-				/* Remove work unit header */
-				skb_pull(skb_prev, RX_DATA_WU_HEADER_LEN);
-				skb_prev->protocol =
-					eth_type_trans(skb_prev, dev);
+				adi_msp_rx_lat_done(lp, rx_dev, skb);
 
-				/* Pass the packet to upper layers */
-				netif_receive_skb(skb_prev);
-				//napi_gro_receive(&lp->rx_napi, skb_prev);
-				lp->stats.nl.rx_packets++;
-				lp->stats.nl.rx_bytes += pkt_len;
+				/* Pass the packet to upper layers. GRO marks
+				 * NAPI ID for busy polling by itself.
+				 */
+				if (gro) {
+					napi_gro_receive(&lp->rx_napi, skb);
+				} else {
+					skb_mark_napi_id(skb, &lp->rx_napi);
+					netif_receive_skb(skb);
+				}
+				adi_msp_stats_add_frame(rs, pkt_len);
 
 				count++;
 			}
+
+rearm_status_wu:
+			/* Status work unit has been parsed in place. Its page
+			 * is given back to Rx DMA without allocation.
+			 */
+			adi_msp_rx_arm(lp, idx, STATUS_WU_LEN);
 		} else {
 			/* Invalid work unit header type */
 
 			MSP_DBG("%s: invalid work unit header type, will be dropped\n",
 				dev->name);
 
-			lp->prev_rx_skb[lp->prev_rx_skb_count] = skb;
-			lp->prev_rx_skb_count++;
+			adi_msp_dump_prev_rx_page(dev, wu);
+			adi_msp_drop_prev_rx_page(dev);
 
-			adi_msp_dump_prev_rx_skb(dev);
-			adi_msp_drop_prev_rx_skb(dev, budget);
+			adi_msp_stats_inc(dev_rs, errors);
 
-			lp->stats.nl.rx_errors++;
+			adi_msp_rx_arm(lp, idx, STATUS_WU_LEN);
 		}
 
 		MSP_DBG("%s: now put back rd to rd_ring ...\n", dev->name);
 
-		rd->addrstart = lp->rx_skb_dma[idx];
+		rd->addrstart = lp->rx_buf[idx].dma;
 		rd->cfg = RX_DMA_CFG_COMMON | DMA_CFG_FLOW_STOP;
 
-		chain_prev = (idx - 1) & ADI_MSP_RDS_MASK;
+		chain_prev = (idx - 1) & ADI_MSP_RDS_MASK(lp);
 		lp->rd_ring[chain_prev].cfg = RX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL;
 
-		lp->rx_next_done = (idx + 1) & ADI_MSP_RDS_MASK;
+		lp->rx_next_done = (idx + 1) & ADI_MSP_RDS_MASK(lp);
 		rd = &lp->rd_ring[lp->rx_next_done];
+		done--;
 
 		writel(DMA_STAT_IRQDONE, &lp->rx_dma_regs->stat);
 	}
@@ -1486,38 +3160,104 @@ msp_rx_loop:
 	dma_stat = readl(&lp->rx_dma_regs->stat);
 	if (DMA_STAT_RUN(dma_stat) == DMA_STAT_HALT) {
 		int idx = lp->rx_next_done;
-		struct sk_buff *skb = lp->rx_skb[idx];
+		u8 *wu = adi_msp_rx_wu(lp, idx);
 
 		lp->rx_dma_halt_cnt++;
 
-		if (skb->data[0] == 0) {
+		if (wu[0] == 0) {
 			MSP_DBG("%s: Rx DMA is halted. Restart it from %d\n",
 				dev->name, idx);
 
 			writel(DMA_STAT_IRQDONE | DMA_STAT_IRQERR,
 			       &lp->rx_dma_regs->stat);
 
-			writel(adi_msp_rx_dma(lp, rd - lp->rd_ring),
-			       &lp->rx_dma_regs->dscptr_nxt);
-			writel(RX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
-			       &lp->rx_dma_regs->cfg);
+			writel(adi_msp_rx_dma(lp, rd - lp->rd_ring),
+			       &lp->rx_dma_regs->dscptr_nxt);
+			writel(RX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
+			       &lp->rx_dma_regs->cfg);
+
+			count = min(count, budget - 1);
+		} else if (count < budget) {
+			MSP_DBG("%s: Rx DMA is halted. Use remaining budget\n",
+				dev->name);
+			goto msp_rx_loop;
+		} else {
+			MSP_DBG("%s: Rx DMA is halted. Budget is used up\n",
+				dev->name);
+		}
+	} else {
+		MSP_DBG("%s: DMA is running\n", dev->name);
+	}
+
+	if (xdp_redirect)
+		xdp_do_flush();
+
+	/* Frames of XDP_TX are linked into Tx chain once for the poll */
+	if (xdp_tx)
+		adi_msp_tx_kick(lp);
+
+	MSP_DBG("%s: ... Leaving count = %d\n", dev->name, count);
+
+	return count;
+}
+
+/* Unmask Rx DMA done interrupt, or let rx_coal_timer do it later. Polls
+ * which found fewer than rx_coal_frames work units are not deferred, so
+ * sparse timing traffic still gets interrupts at once. Adaptive moderation
+ * only sets the time.
+ */
+static void adi_msp_rx_irq_rearm(struct adi_msp_private *lp, int work_done)
+{
+	u32 usecs = READ_ONCE(lp->rx_coal_usecs);
+	u32 frames = READ_ONCE(lp->rx_dim_enabled) ?
+		0 : READ_ONCE(lp->rx_coal_frames);
+
+	if (usecs && work_done >= frames) {
+		hrtimer_start(&lp->rx_coal_timer, us_to_ktime(usecs),
+			      HRTIMER_MODE_REL_PINNED);
+		return;
+	}
+
+	adi_msp_enable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+}
+
+static enum hrtimer_restart adi_msp_rx_coal_timer(struct hrtimer *timer)
+{
+	struct adi_msp_private *lp =
+		container_of(timer, struct adi_msp_private, rx_coal_timer);
+
+	adi_msp_enable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
 
-			count = min(count, budget - 1);
-		} else if (count < budget) {
-			MSP_DBG("%s: Rx DMA is halted. Use remaining budget\n",
-				dev->name);
-			goto msp_rx_loop;
-		} else {
-			MSP_DBG("%s: Rx DMA is halted. Budget is used up\n",
-				dev->name);
-		}
-	} else {
-		MSP_DBG("%s: DMA is running\n", dev->name);
+	return HRTIMER_NORESTART;
+}
+
+static void adi_msp_rx_dim_update(struct adi_msp_private *lp)
+{
+	struct dim_sample sample = {};
+	u64 packets = 0, bytes = 0;
+	int port;
+
+	/* Counters of Rx NAPI itself, no need to retry */
+	for (port = 0; port < ADI_MSP_NUM_PORTS; port++) {
+		packets += lp->rx_stats[port].packets;
+		bytes += lp->rx_stats[port].bytes;
 	}
 
-	MSP_DBG("%s: ... Leaving count = %d\n", dev->name, count);
+	dim_update_sample(lp->rx_dim_event_ctr++, packets, bytes, &sample);
+	net_dim(&lp->rx_dim, sample);
+}
 
-	return count;
+static void adi_msp_rx_dim_work(struct work_struct *work)
+{
+	struct dim *dim = container_of(work, struct dim, work);
+	struct adi_msp_private *lp =
+		container_of(dim, struct adi_msp_private, rx_dim);
+	struct dim_cq_moder moder;
+
+	moder = net_dim_get_rx_moderation(dim->mode, dim->profile_ix);
+	WRITE_ONCE(lp->rx_coal_usecs, moder.usec);
+
+	dim->state = DIM_START_MEASURE;
 }
 
 static int adi_msp_rx_poll(struct napi_struct *napi, int budget)
@@ -1529,13 +3269,35 @@ static int adi_msp_rx_poll(struct napi_struct *napi, int budget)
 
 	work_done = adi_msp_rx(dev, budget);
 	if (work_done < budget) {
-		napi_complete_done(napi, work_done);
-		adi_msp_enable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+		/* This also flushes GRO. Leave interrupt masked if NAPI is
+		 * scheduled again or busy polled, it's rearmed when that
+		 * completes.
+		 */
+		if (!napi_complete_done(napi, work_done))
+			return work_done;
+
+		/* Busy polls are not started by the interrupt */
+		lp->rx_irq_time = 0;
+
+		if (READ_ONCE(lp->rx_dim_enabled))
+			adi_msp_rx_dim_update(lp);
+
+		adi_msp_rx_irq_rearm(lp, work_done);
+	} else {
+		/* Don't hold frames in GRO until the next poll */
+		napi_gro_flush(napi, false);
 	}
 	return work_done;
 }
 
-/* TODO  implement a recover method */
+/* Tx cannot be reset in interrupt context or with Tx queue locks held */
+static void adi_msp_schedule_tx_reset(struct adi_msp_private *lp)
+{
+	WRITE_ONCE(lp->tx_reset_pending, true);
+	if (schedule_work(&lp->tx_reset_work))
+		atomic64_inc(&lp->tx_reset);
+}
+
 static irqreturn_t adi_msp_tx_dma_error_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = dev_id;
@@ -1555,6 +3317,9 @@ static irqreturn_t adi_msp_tx_dma_error_interrupt(int irq, void *dev_id)
 
 	writel(DMA_STAT_IRQERR, &lp->tx_dma_regs->stat);
 
+	atomic64_inc(&lp->tx_errors[lp->port]);
+	adi_msp_schedule_tx_reset(lp);
+
 	return IRQ_HANDLED;
 }
 
@@ -1594,6 +3359,9 @@ static irqreturn_t adi_msp_status_dma_error_interrupt(int irq, void *dev_id)
 
 	writel(DMA_STAT_IRQERR, &lp->status_dma_regs->stat);
 
+	atomic64_inc(&lp->tx_errors[lp->port]);
+	adi_msp_schedule_tx_reset(lp);
+
 	return IRQ_HANDLED;
 }
 
@@ -1628,13 +3396,93 @@ static void adi_msp_show_tx_status(struct net_device *dev)
 		dev->name, intr_stat & 0x1);
 }
 
+/* Report completed frames to BQL of each Tx queue of each port and clear
+ * the counts
+ */
+static void adi_msp_tx_completed(struct adi_msp_private *lp,
+				 unsigned int pkts[][ADI_MSP_NUM_TXQS],
+				 unsigned int bytes[][ADI_MSP_NUM_TXQS])
+{
+	struct net_device *dev;
+	int port;
+	u16 queue;
+
+	for (port = 0; port < ADI_MSP_NUM_PORTS; port++) {
+		dev = lp->port_dev[port];
+		if (!dev)
+			continue;
+
+		for (queue = 0; queue < ADI_MSP_NUM_TXQS; queue++) {
+			netdev_tx_completed_queue(netdev_get_tx_queue(dev, queue),
+						  pkts[port][queue],
+						  bytes[port][queue]);
+			pkts[port][queue] = 0;
+			bytes[port][queue] = 0;
+		}
+	}
+}
+
+/* Account the latencies of the frame starting at IDX, whose Tx status work
+ * unit is being processed
+ */
+static void adi_msp_tx_lat_done(struct adi_msp_private *lp, int idx,
+				struct sk_buff *skb, u8 tag)
+{
+	struct adi_msp_tx_time *tt = lp->tx_time ? &lp->tx_time[idx] : NULL;
+	u64 xmit_to_kick = 0, kick_to_status = 0;
+
+	if (tt && tt->xmit) {
+		ktime_t now = ktime_get();
+
+		adi_msp_lat_sync(READ_ONCE(lp->lat_clear_gen), &lp->tx_lat_gen,
+				 lp->tx_lat, sizeof(lp->tx_lat));
+
+		xmit_to_kick = ktime_to_ns(ktime_sub(tt->kick, tt->xmit));
+		kick_to_status = ktime_to_ns(ktime_sub(now, tt->kick));
+
+		adi_msp_lat_add(&lp->tx_lat[ADI_MSP_TX_LAT_XMIT_KICK],
+				xmit_to_kick);
+		adi_msp_lat_add(&lp->tx_lat[ADI_MSP_TX_LAT_KICK_STATUS],
+				kick_to_status);
+		adi_msp_lat_add(&lp->tx_lat[ADI_MSP_TX_LAT_XMIT_STATUS],
+				xmit_to_kick + kick_to_status);
+	}
+
+	trace_adi_msp_tx_status(skb->dev, skb, tag, xmit_to_kick,
+				kick_to_status);
+}
+
+/* Free a frame taken off Tx ring by adi_msp_status(), when Tx is to be
+ * reset before its status is handled. Tx reset only frees what is left in
+ * the ring. Returns 1 for a frame of AF_XDP socket, which has neither SKB
+ * nor XDPF and is only completed.
+ */
+static int adi_msp_free_tx_frame(struct sk_buff *skb, struct xdp_frame *xdpf)
+{
+	if (skb) {
+		dev_kfree_skb_any(skb);
+		return 0;
+	}
+	if (xdpf) {
+		xdp_return_frame(xdpf);
+		return 0;
+	}
+	return 1;
+}
+
 static int adi_msp_status(struct net_device *dev, int budget)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
 	struct dma_desc *sd = &lp->sd_ring[lp->tx_next_done];
+	unsigned int pkts_compl[ADI_MSP_NUM_PORTS][ADI_MSP_NUM_TXQS] = { 0 };
+	unsigned int bytes_compl[ADI_MSP_NUM_PORTS][ADI_MSP_NUM_TXQS] = { 0 };
 	unsigned long flags;
 	u32 dma_stat;
 	int count;
+	int done = 0;
+	int xsk_frames = 0;
+	int port;
+	u16 queue;
 
 	MSP_DBG("%s: Entering %s ...\n", dev->name, __func__);
 
@@ -1646,12 +3494,13 @@ msp_status_loop:
 		int idx = lp->tx_next_done;
 		union status_wu *wu;
 		unsigned char *tx_wu;
-		struct tx_wu_header *tx_wu_hdr;
+		struct tx_wu_header tx_wu_hdr;
 		struct sk_buff *skb;
-		int tmp;
-		u32 addr_cur, dscptr_prv, addrstart;
+		struct xdp_frame *xdpf;
+		struct adi_msp_ctx_stats *ts;
+		int tmp, td_idx, nr_descs;
+		bool xsk;
 		u32 chain_prev;
-		u32 length;
 		u8 byte0, tag, ptp;
 
 		MSP_DBG("%s: count = %d idx = %d\n", dev->name, count, idx);
@@ -1671,83 +3520,129 @@ msp_status_loop:
 			break;
 
 		/* If the first byte is not zero, this work unit has been
-		 * started. But if the current address is still in this work
-		 * unit and the initial descriptor address has not been
-		 * copied into the DSCPTR_PREV register, this work unit is
-		 * not done yet.
+		 * started. Read DMA registers only when it's past the work
+		 * units known to be done.
 		 */
-		addr_cur = readl(&lp->status_dma_regs->addr_cur);
-		dscptr_prv = readl(&lp->status_dma_regs->dscptr_prv);
-		dscptr_prv &= ~0x3;
-		addrstart = lp->sd_ring[idx].addrstart;
-		if (addr_cur >= addrstart &&
-		    addr_cur < addrstart + STATUS_WU_LEN &&
-		    dscptr_prv != adi_msp_status_dma(lp, idx))
-			break;
+		if (done == 0) {
+			done = adi_msp_dma_done_count(lp->status_dma_regs,
+						      lp->sd_ring, lp->sd_dma,
+						      ADI_MSP_SDS_MASK(lp), idx,
+						      STATUS_WU_LEN,
+						      &lp->status_stale_dscptr);
+			if (done == 0)
+				break;
+		}
 
 		/* If work unit type is not expected, have to reset Tx */
 		if (unlikely((byte0 & WU_TYPE_MASK) != WU_TYPE_TX_STAT)) {
 			MSP_ERR("%s: Invalid Tx status work unit header type (%d)",
 				dev->name, byte0 & WU_TYPE_MASK);
-			lp->stats.nl.tx_errors++;
-			lp->stats.nl.tx_reset++;
+			adi_msp_stats_inc(&lp->tx_stats[lp->port], errors);
 			goto reset_tx;
 		}
 
 		/* If the corresponding Tx work unit does not exist, have to
 		 * reset Tx
 		 */
-		skb = lp->tx_skb[idx];
-		if (unlikely(!skb)) {
-			MSP_ERR("%s: tx_skb[%d] == NULL\n", dev->name, idx);
-			lp->stats.nl.tx_errors++;
-			lp->stats.nl.tx_reset++;
+		td_idx = lp->td_next_done;
+		skb = lp->tx_buf[td_idx].skb;
+		xdpf = lp->tx_buf[td_idx].xdpf;
+		xsk = lp->tx_buf[td_idx].xsk;
+		if (unlikely(!skb && !xdpf && !xsk)) {
+			MSP_ERR("%s: tx_buf[%d] is empty\n", dev->name, td_idx);
+			adi_msp_stats_inc(&lp->tx_stats[lp->port], errors);
 			goto reset_tx;
 		}
 
 		/* Process this SKB and Tx wu */
 
-#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
-		length = round_up(skb->len + TX_WU_HEADER_LEN, 8);
-#else
-		length = skb->len + TX_WU_HEADER_LEN;
-#endif
+		nr_descs = lp->tx_buf[td_idx].descs;
+		adi_msp_unmap_tx_skb(lp, td_idx, nr_descs);
+
+		if (skb)
+			adi_msp_tx_lat_done(lp, td_idx, skb, tag);
 
-		dma_unmap_single(lp->dmadev, lp->tx_skb_dma[idx], length,
-				 DMA_TO_DEVICE);
+		lp->tx_buf[td_idx].skb = NULL;
+		lp->tx_buf[td_idx].xdpf = NULL;
+		lp->tx_buf[td_idx].xsk = false;
+		lp->td_next_done = (td_idx + nr_descs) & ADI_MSP_TDS_MASK(lp);
 
-		lp->tx_skb[idx] = NULL;
+		if (xdpf)
+			tx_wu = (unsigned char *)xdpf->data - TX_WU_HEADER_LEN;
+		else if (lp->tx_buf[td_idx].bounced)
+			tx_wu = adi_msp_tx_bounce(lp, td_idx);
+		else
+			tx_wu = skb->data - TX_WU_HEADER_LEN;
+		/* Bounce buffer can be reused once descriptors are released */
+		tx_wu_hdr = *(struct tx_wu_header *)tx_wu;
+
+		port = (tx_wu_hdr.byte0 & TX_WU_PORT_1) ? 1 : 0;
+		ts = &lp->tx_stats[port];
+
+		/* XDP frames are not accounted by BQL */
+		if (skb) {
+			queue = skb_get_queue_mapping(skb);
+			pkts_compl[port][queue]++;
+			bytes_compl[port][queue] += tx_wu_hdr.frame_len;
+		}
 
-		tmp = atomic_dec_return(&lp->tx_count);
-		MSP_DBG("%s: tx_count dec by 1 = %d\n", dev->name, tmp);
+		tmp = atomic_sub_return(nr_descs, &lp->tx_count);
+		MSP_DBG("%s: tx_count dec by %d = %d\n", dev->name, nr_descs, tmp);
 
 		if (unlikely(put_frame_tag(lp, tag, ptp) < 0)) {
-			lp->stats.nl.tx_errors++;
-			lp->stats.nl.tx_reset++;
+			adi_msp_stats_inc(ts, errors);
+			xsk_frames += adi_msp_free_tx_frame(skb, xdpf);
 			goto reset_tx;
 		}
 
-		if (netif_queue_stopped(dev) &&
-		    atomic_read(&lp->tx_count) <= ADI_MSP_NUM_TDS - ADI_MSP_STOP_QUEUE_TH &&
-		    atomic_read(&lp->available_ptp_frame_tag_count) >= ADI_MSP_STOP_QUEUE_TH &&
-		    atomic_read(&lp->available_nonptp_frame_tag_count) >= ADI_MSP_STOP_QUEUE_TH) {
-			MSP_DBG("%s: call netif_wake_queue()\n", dev->name);
-			netif_wake_queue(dev);
-		}
+		/* Pairs with smp_mb() in adi_msp_xmit() */
+		smp_mb();
+		for (port = 0; port < ADI_MSP_NUM_PORTS; port++) {
+			struct net_device *ndev = lp->port_dev[port];
+
+			if (!ndev)
+				continue;
+
+			for (queue = 0; queue < ADI_MSP_NUM_TXQS; queue++) {
+				struct netdev_queue *txq =
+					netdev_get_tx_queue(ndev, queue);
 
-		tx_wu = skb->data - TX_WU_HEADER_LEN;
-		tx_wu_hdr = (struct tx_wu_header *)tx_wu;
+				if (netif_tx_queue_stopped(txq) &&
+				    adi_msp_txq_has_room(lp, queue)) {
+					MSP_DBG("%s: wake Tx queue %d\n",
+						ndev->name, queue);
+					netif_tx_wake_queue(txq);
+				}
+			}
+		}
 
-		if (unlikely(tag != tx_wu_hdr->frame_tag)) {
+		if (unlikely(tag != tx_wu_hdr.frame_tag)) {
 			MSP_ERR("%s: status wu tag (%d) does not match Tx wu tag (%d)\n",
-				dev->name, tag, tx_wu_hdr->frame_tag);
-			lp->stats.nl.tx_errors++;
-			lp->stats.nl.tx_reset++;
+				dev->name, tag, tx_wu_hdr.frame_tag);
+			adi_msp_stats_inc(ts, errors);
+			xsk_frames += adi_msp_free_tx_frame(skb, xdpf);
 			goto reset_tx;
 		}
 
+		if (xdpf || xsk) {
+			if (unlikely(byte0 & TX_STATUS_WU_ERR)) {
+				MSP_ERR("%s: Transmit error for XDP frame (frame tag: %d)",
+					dev->name, tag);
+				adi_msp_show_tx_status(dev);
+				adi_msp_stats_inc(ts, errors);
+			} else {
+				adi_msp_stats_add_frame(ts, tx_wu_hdr.frame_len);
+			}
+
+			if (xdpf)
+				xdp_return_frame(xdpf);
+			else
+				xsk_frames++;
+			goto reset_desc_and_wu;
+		}
+
 		if (unlikely(byte0 & TX_STATUS_WU_ERR)) {
-			if (ptp && get_timestamp_ns(wu) == 0)
+			if (ptp && get_timestamp_ns(&lp->tx_ts_cache, wu) == 0)
 				MSP_ERR("%s: Failed to get timestamp for TX PTP (frame tag: %d)",
 					dev->name, tag);
 			else
@@ -1755,7 +3650,7 @@ msp_status_loop:
 					dev->name, tag);
 
 			adi_msp_show_tx_status(dev);
-			lp->stats.nl.tx_errors++;
+			adi_msp_stats_inc(ts, errors);
 			napi_consume_skb(skb, budget);
 			goto reset_desc_and_wu;
 		} else if (unlikely(skb_shinfo(skb)->tx_flags & SKBTX_IN_PROGRESS)) {
@@ -1763,7 +3658,7 @@ msp_status_loop:
 
 			if (likely(ptp)) {
 				struct skb_shared_hwtstamps shhwtstamps;
-				u64 ns = get_timestamp_ns(wu);
+				u64 ns = get_timestamp_ns(&lp->tx_ts_cache, wu);
 
 				memset(&shhwtstamps, 0, sizeof(shhwtstamps));
 				shhwtstamps.hwtstamp = ns_to_ktime(ns);
@@ -1772,14 +3667,13 @@ msp_status_loop:
 			} else {
 				MSP_ERR("%s: PTP flag not set in Tx status work unit (frame tag: %d)",
 					dev->name, tag);
-				lp->stats.nl.tx_errors++;
+				adi_msp_stats_inc(ts, errors);
 				napi_consume_skb(skb, budget);
 				goto reset_desc_and_wu;
 			}
 		}
 
-		lp->stats.nl.tx_packets++;
-		lp->stats.nl.tx_bytes += tx_wu_hdr->frame_len;
+		adi_msp_stats_add_frame(ts, tx_wu_hdr.frame_len);
 
 		napi_consume_skb(skb, budget);
 
@@ -1792,41 +3686,23 @@ reset_desc_and_wu:
 
 		sd->cfg = STATUS_DMA_CFG_COMMON | DMA_CFG_FLOW_STOP;
 
-		chain_prev = (idx - 1) & ADI_MSP_SDS_MASK;
+		chain_prev = (idx - 1) & ADI_MSP_SDS_MASK(lp);
 		lp->sd_ring[chain_prev].cfg = STATUS_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL;
 
-		lp->tx_next_done = (idx + 1) & ADI_MSP_SDS_MASK;
+		lp->tx_next_done = (idx + 1) & ADI_MSP_SDS_MASK(lp);
 		sd = &lp->sd_ring[lp->tx_next_done];
+		done--;
 
 		writel(DMA_STAT_IRQDONE, &lp->status_dma_regs->stat);
 	}
 
+	adi_msp_tx_completed(lp, pkts_compl, bytes_compl);
+	if (xsk_frames)
+		xsk_tx_completed(lp->xsk_pool, xsk_frames);
+
 	/* Restart Tx DMA if we have something to send and it's halted */
 	spin_lock_irqsave(&lp->lock, flags);
-
-	dma_stat = readl(&lp->tx_dma_regs->stat);
-	if (DMA_STAT_RUN(dma_stat) == DMA_STAT_HALT) {
-		if (lp->tx_chain_status == FILLED) {
-			MSP_DBG("%s: Tx DMA is halted and chain is filled, restart DMA from chain head %d\n",
-				dev->name, lp->tx_chain_head);
-
-			writel(adi_msp_tx_dma(lp, lp->tx_chain_head),
-			       &lp->tx_dma_regs->dscptr_nxt);
-			writel(TX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL,
-			       &lp->tx_dma_regs->cfg);
-
-			lp->tx_chain_head = lp->tx_chain_tail;
-			lp->tx_chain_status = EMPTY;
-
-			netif_trans_update(dev);
-
-		} else {
-			MSP_DBG("%s: Tx DMA is halted but chain is empty\n", dev->name);
-		}
-	} else {
-		MSP_DBG("%s: Tx DMA is running\n", dev->name);
-	}
-
+	adi_msp_tx_kick_locked(lp);
 	spin_unlock_irqrestore(&lp->lock, flags);
 
 	/* See comment in adi_msp_rx() */
@@ -1868,11 +3744,25 @@ reset_desc_and_wu:
 	return count;
 
 reset_tx:
-	/* TODO  implement reset MSP Tx */
+	adi_msp_tx_completed(lp, pkts_compl, bytes_compl);
+	if (xsk_frames)
+		xsk_tx_completed(lp->xsk_pool, xsk_frames);
+
 	MSP_ERR("%s: reset MSP Tx\n", dev->name);
+	adi_msp_schedule_tx_reset(lp);
 	return count;
 }
 
+static enum hrtimer_restart adi_msp_status_coal_timer(struct hrtimer *timer)
+{
+	struct adi_msp_private *lp =
+		container_of(timer, struct adi_msp_private, status_coal_timer);
+
+	adi_msp_enable_status_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+
+	return HRTIMER_NORESTART;
+}
+
 static int adi_msp_status_poll(struct napi_struct *napi, int budget)
 {
 	struct adi_msp_private *lp =
@@ -1880,15 +3770,103 @@ static int adi_msp_status_poll(struct napi_struct *napi, int budget)
 	struct net_device *dev = lp->dev;
 	int work_done;
 
+	/* Status work units are not trusted until Tx is reset. Leave Tx
+	 * status DMA done interrupt masked, adi_msp_tx_reset_work() unmasks
+	 * it.
+	 */
+	if (unlikely(READ_ONCE(lp->tx_reset_pending))) {
+		napi_complete_done(napi, 0);
+		return 0;
+	}
+
 	work_done = adi_msp_status(dev, budget);
+
+	/* Frames of AF_XDP socket are sent with the same budget. Keep
+	 * polling while it has more.
+	 */
+	if (lp->xsk_pool && !adi_msp_xsk_xmit(lp, budget))
+		work_done = budget;
+
 	if (work_done < budget) {
-		napi_complete_done(napi, work_done);
-		adi_msp_enable_status_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+		u32 usecs = READ_ONCE(lp->tx_coal_usecs);
+
+		if (!napi_complete_done(napi, work_done))
+			return work_done;
+
+		if (usecs)
+			hrtimer_start(&lp->status_coal_timer, us_to_ktime(usecs),
+				      HRTIMER_MODE_REL_PINNED);
+		else
+			adi_msp_enable_status_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
 	}
 	return work_done;
 }
 
 /* ethtool helpers */
+/* Standard counters kept by E-tile, bridge and MSP of lp->dev, from the last
+ * collection. Frames dropped by the MAC for bad FCS or length never reach
+ * the driver, so they are added to rx_errors here.
+ */
+static void adi_msp_get_hw_nl_stats(struct adi_msp_private *lp,
+				    struct adi_msp_nl_stats *nl)
+{
+	const struct adi_msp_hw_stats *hw = &lp->stats.hw;
+	u64 length_errors;
+
+	spin_lock_bh(&lp->hw_stats_lock);
+
+	nl->multicast = hw->etile_rx.rx_multicast_frames;
+	nl->rx_crc_errors = hw->etile_rx.rx_fcs_errors;
+	length_errors = hw->etile_rx.rx_runt_packets +
+			hw->etile_rx.rx_oversize_frames +
+			hw->etile_rx.rx_length_errored_frames;
+	nl->rx_length_errors += length_errors;
+	nl->rx_errors += nl->rx_crc_errors + length_errors;
+
+	/* Dropped by MSP Rx before reaching Rx DMA */
+	nl->rx_missed_errors = hw->msp_rx.rx_dropped_mplane +
+			       hw->msp_rx.rx_dropped_splane;
+#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
+	nl->rx_fifo_errors = hw->async_fifo_rx.rx_dropped;
+#endif
+
+	spin_unlock_bh(&lp->hw_stats_lock);
+}
+
+/* Add up netlink counters of the port. The ones not kept are left 0. */
+static void adi_msp_get_nl_stats(struct adi_msp_private *lp, int port,
+				 struct adi_msp_nl_stats *nl)
+{
+	const struct adi_msp_ctx_stats *rs = &lp->rx_stats[port];
+	const struct adi_msp_ctx_stats *ts = &lp->tx_stats[port];
+	unsigned int start;
+
+	memset(nl, 0, sizeof(*nl));
+
+	do {
+		start = u64_stats_fetch_begin_irq(&rs->syncp);
+		nl->rx_packets = rs->packets;
+		nl->rx_bytes = rs->bytes;
+		nl->rx_errors = rs->errors;
+		nl->rx_dropped = rs->dropped;
+		nl->rx_length_errors = rs->length_errors;
+	} while (u64_stats_fetch_retry_irq(&rs->syncp, start));
+
+	do {
+		start = u64_stats_fetch_begin_irq(&ts->syncp);
+		nl->tx_packets = ts->packets;
+		nl->tx_bytes = ts->bytes;
+		nl->tx_errors = ts->errors;
+	} while (u64_stats_fetch_retry_irq(&ts->syncp, start));
+
+	nl->tx_errors += atomic64_read(&lp->tx_errors[port]);
+	nl->tx_dropped = atomic64_read(&lp->tx_dropped[port]);
+	nl->tx_reset = atomic64_read(&lp->tx_reset);
+
+	if (port == lp->port)
+		adi_msp_get_hw_nl_stats(lp, nl);
+}
+
 static void adi_msp_get_drvinfo(struct net_device *dev,
 				struct ethtool_drvinfo *info)
 {
@@ -1927,6 +3905,14 @@ static const char adi_msp_gstrings[][ETH_GSTRING_LEN] = {
 #define ADI_MSP_STAT(S, OFFSET) "msp."#S,
 	ADI_MSP_RX_STATS
 #undef ADI_MSP_STAT
+
+#define ADI_MSP_XDP_STAT(S) "xdp."#S,
+	ADI_MSP_XDP_STATS
+#undef ADI_MSP_XDP_STAT
+
+#define ADI_MSP_TX_RESET_STAT(S) "tx_reset."#S,
+	ADI_MSP_TX_RESET_STATS
+#undef ADI_MSP_TX_RESET_STAT
 };
 
 #define ADI_MSP_STATS_LEN ARRAY_SIZE(adi_msp_gstrings)
@@ -1998,35 +3984,52 @@ static void adi_msp_get_strings(struct net_device *netdev, u32 stringset, u8 *da
 	}
 }
 
-static void fill_intel_etile_tx_stats(struct adi_msp_private *lp)
+/* Read a 64-bit E-tile counter without tearing. If the high half changes
+ * between the reads, the low half has wrapped and is read again.
+ */
+static u64 adi_msp_read_etile_stat(struct adi_msp_private *lp, int offset)
+{
+	void __iomem *lo = lp->etile_regs + offset * 4;
+	void __iomem *hi = lo + 4;
+	u32 h, l, h2;
+
+	h = readl(hi);
+	l = readl(lo);
+	h2 = readl(hi);
+	if (h != h2)
+		l = readl(lo);
+
+	return (u64)h2 << 32 | l;
+}
+
+static void fill_intel_etile_tx_stats(struct adi_msp_private *lp,
+				      struct adi_msp_hw_stats *hw)
 {
-	u64 *data = (u64 *)&lp->stats.etile_tx;
+	u64 *data = (u64 *)&hw->etile_tx;
 	int num = ARRAY_SIZE(intel_etile_tx_stats_offsets);
 	const int *offsets = intel_etile_tx_stats_offsets;
 	int i;
 
-	for (i = 0; i < num; i++) {
-		data[i] = readl(lp->etile_regs + (offsets[i] + 1) * 4);
-		data[i] = (data[i] << 32) + readl(lp->etile_regs + offsets[i] * 4);
-	}
+	for (i = 0; i < num; i++)
+		data[i] = adi_msp_read_etile_stat(lp, offsets[i]);
 }
 
-static void fill_intel_etile_rx_stats(struct adi_msp_private *lp)
+static void fill_intel_etile_rx_stats(struct adi_msp_private *lp,
+				      struct adi_msp_hw_stats *hw)
 {
-	u64 *data = (u64 *)&lp->stats.etile_rx;
+	u64 *data = (u64 *)&hw->etile_rx;
 	int num = ARRAY_SIZE(intel_etile_rx_stats_offsets);
 	const int *offsets = intel_etile_rx_stats_offsets;
 	int i;
 
-	for (i = 0; i < num; i++) {
-		data[i] = readl(lp->etile_regs + (offsets[i] + 1) * 4);
-		data[i] = (data[i] << 32) + readl(lp->etile_regs + offsets[i] * 4);
-	}
+	for (i = 0; i < num; i++)
+		data[i] = adi_msp_read_etile_stat(lp, offsets[i]);
 }
 
-static void fill_bridge_mac_oif_stats(struct adi_msp_private *lp)
+static void fill_bridge_mac_oif_stats(struct adi_msp_private *lp,
+				      struct adi_msp_hw_stats *hw)
 {
-	u64 *data = (u64 *)&lp->stats.bridge_mac_oif;
+	u64 *data = (u64 *)&hw->bridge_mac_oif;
 	int num = ARRAY_SIZE(adi_bridge_mac_oif_stats_offsets);
 	const int *offsets = adi_bridge_mac_oif_stats_offsets;
 	int i;
@@ -2038,9 +4041,10 @@ static void fill_bridge_mac_oif_stats(struct adi_msp_private *lp)
 	writel(0, lp->etile_regs + 0x4004);
 }
 
-static void fill_oif_tx_stats(struct adi_msp_private *lp)
+static void fill_oif_tx_stats(struct adi_msp_private *lp,
+			      struct adi_msp_hw_stats *hw)
 {
-	u64 *data = (u64 *)&lp->stats.oif_tx;
+	u64 *data = (u64 *)&hw->oif_tx;
 	int num = ARRAY_SIZE(adi_oif_tx_stats_offsets);
 	const int *offsets = adi_oif_tx_stats_offsets;
 	int i;
@@ -2049,9 +4053,10 @@ static void fill_oif_tx_stats(struct adi_msp_private *lp)
 		data[i] = readl((void __iomem *)(lp->oif_tx_regs) + offsets[i]);
 }
 
-static void fill_oif_rx_stats(struct adi_msp_private *lp)
+static void fill_oif_rx_stats(struct adi_msp_private *lp,
+			      struct adi_msp_hw_stats *hw)
 {
-	u64 *data = (u64 *)&lp->stats.oif_rx;
+	u64 *data = (u64 *)&hw->oif_rx;
 	int num = ARRAY_SIZE(adi_oif_rx_stats_offsets);
 	const int *offsets = adi_oif_rx_stats_offsets;
 	int i;
@@ -2060,118 +4065,533 @@ static void fill_oif_rx_stats(struct adi_msp_private *lp)
 		data[i] = readl((void __iomem *)(lp->oif_rx_regs) + offsets[i]);
 }
 
-#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
-static void fill_async_fifo_rx_stats(struct adi_msp_private *lp)
-{
-	u64 *data = (u64 *)&lp->stats.async_fifo_rx;
-	int num = ARRAY_SIZE(adi_async_fifo_rx_stats_offsets);
-	const int *offsets = adi_async_fifo_rx_stats_offsets;
-	int i;
+#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
+/* The counter has only 31 bits */
+#define ADI_ASYNC_FIFO_STAT_MASK	0x7fffffff
+
+static void fill_async_fifo_rx_stats(struct adi_msp_private *lp,
+				     struct adi_msp_hw_stats *hw)
+{
+	u64 *data = (u64 *)&hw->async_fifo_rx;
+	int num = ARRAY_SIZE(adi_async_fifo_rx_stats_offsets);
+	const int *offsets = adi_async_fifo_rx_stats_offsets;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		data[i] = readl(lp->async_fifo_rx_regs + offsets[i]);
+		if (offsets[i] == 0x10)
+			data[i] &= ADI_ASYNC_FIFO_STAT_MASK;
+	}
+}
+#endif
+
+static void fill_msp_rx_stats(struct adi_msp_private *lp,
+			      struct adi_msp_hw_stats *hw)
+{
+	u64 *data = (u64 *)&hw->msp_rx;
+	int num = ARRAY_SIZE(adi_msp_rx_stats_offsets);
+	const int *offsets = adi_msp_rx_stats_offsets;
+	int i;
+
+	for (i = 0; i < num; i++)
+		data[i] = readl((void __iomem *)(lp->rx_regs) + offsets[i]);
+}
+
+/* Add what 32-bit counters have counted since the last collection */
+static void adi_msp_acc_hw_stats(u64 *acc, u64 *last, const u64 *raw,
+				 int num, u32 mask)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		acc[i] += (u32)(raw[i] - last[i]) & mask;
+		last[i] = raw[i];
+	}
+}
+
+/* Read all hardware counters, about a hundred MMIO reads, and publish them
+ * in lp->stats.hw. Readers only hold hw_stats_lock for the copy.
+ */
+static void adi_msp_collect_hw_stats(struct adi_msp_private *lp)
+{
+	struct adi_msp_hw_stats *raw = &lp->hw_read;
+	struct adi_msp_hw_stats *acc = &lp->stats.hw;
+	struct adi_msp_hw_stats *last = &lp->hw_last;
+
+	mutex_lock(&lp->hw_stats_mutex);
+
+	fill_intel_etile_tx_stats(lp, raw);
+	fill_intel_etile_rx_stats(lp, raw);
+	fill_bridge_mac_oif_stats(lp, raw);
+	fill_oif_tx_stats(lp, raw);
+	fill_oif_rx_stats(lp, raw);
+#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
+	fill_async_fifo_rx_stats(lp, raw);
+#endif
+	fill_msp_rx_stats(lp, raw);
+
+	spin_lock_bh(&lp->hw_stats_lock);
+	acc->etile_tx = raw->etile_tx;
+	acc->etile_rx = raw->etile_rx;
+#define ADI_MSP_ACC_HW_STATS(G, MASK) \
+	adi_msp_acc_hw_stats((u64 *)&acc->G, (u64 *)&last->G, \
+			     (const u64 *)&raw->G, \
+			     sizeof(raw->G) / sizeof(u64), MASK)
+
+	ADI_MSP_ACC_HW_STATS(bridge_mac_oif, U32_MAX);
+	ADI_MSP_ACC_HW_STATS(oif_tx, U32_MAX);
+	ADI_MSP_ACC_HW_STATS(oif_rx, U32_MAX);
+#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
+	ADI_MSP_ACC_HW_STATS(async_fifo_rx, ADI_ASYNC_FIFO_STAT_MASK);
+#endif
+	ADI_MSP_ACC_HW_STATS(msp_rx, U32_MAX);
+
+#undef ADI_MSP_ACC_HW_STATS
+	spin_unlock_bh(&lp->hw_stats_lock);
+
+	mutex_unlock(&lp->hw_stats_mutex);
+}
+
+static void adi_msp_hw_stats_work(struct work_struct *work)
+{
+	struct adi_msp_private *lp =
+		container_of(to_delayed_work(work), struct adi_msp_private,
+			     hw_stats_work);
+	u32 usecs = READ_ONCE(lp->hw_stats_usecs);
+
+	adi_msp_collect_hw_stats(lp);
+	schedule_delayed_work(&lp->hw_stats_work, usecs_to_jiffies(usecs));
+}
+
+static void adi_msp_get_ethtool_stats(struct net_device *dev,
+				      struct ethtool_stats *stats, u64 *data)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct adi_msp_nl_stats nl;
+
+	adi_msp_get_nl_stats(lp, lp->port, &nl);
+
+	spin_lock_bh(&lp->hw_stats_lock);
+	lp->stats.nl = nl;
+	memcpy(data, &lp->stats, sizeof(lp->stats));
+	spin_unlock_bh(&lp->hw_stats_lock);
+}
+
+static void adi_msp_get_pause_stats(struct net_device *dev,
+				    struct ethtool_pause_stats *pause_stats)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	spin_lock_bh(&lp->hw_stats_lock);
+	pause_stats->tx_pause_frames = lp->stats.hw.etile_tx.tx_pause_frames;
+	pause_stats->rx_pause_frames = lp->stats.hw.etile_rx.rx_pause_frames;
+	spin_unlock_bh(&lp->hw_stats_lock);
+}
+
+static int adi_msp_get_ts_info(struct net_device *dev,
+			       struct ethtool_ts_info *info)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	if (lp->has_ptp) {
+		info->phc_index = ptp_clock_index(lp->ptp_clk);
+
+		info->so_timestamping = SOF_TIMESTAMPING_TX_HARDWARE |
+					SOF_TIMESTAMPING_RX_HARDWARE |
+					SOF_TIMESTAMPING_RAW_HARDWARE;
+
+		info->tx_types = (1 << HWTSTAMP_TX_OFF) |
+				 (1 << HWTSTAMP_TX_ON);
+
+		info->rx_filters = (1 << HWTSTAMP_FILTER_NONE) |
+				   (1 << HWTSTAMP_FILTER_ALL) |
+				   (1 << HWTSTAMP_FILTER_PTP_V2_L2_EVENT) |
+				   (1 << HWTSTAMP_FILTER_PTP_V2_L4_EVENT) |
+				   (1 << HWTSTAMP_FILTER_PTP_V2_EVENT);
+
+		return 0;
+	} else {
+		return ethtool_op_get_ts_info(dev, info);
+	}
+}
+
+static int adi_msp_get_tunable(struct net_device *dev,
+			       const struct ethtool_tunable *tuna, void *data)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		*(u32 *)data = lp->rx_copybreak;
+		return 0;
+	case ETHTOOL_TX_COPYBREAK:
+		*(u32 *)data = lp->tx_copybreak;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int adi_msp_set_tunable(struct net_device *dev,
+			       const struct ethtool_tunable *tuna,
+			       const void *data)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	u32 copybreak;
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		copybreak = *(const u32 *)data;
+		if (copybreak > RX_COPYBREAK_MAX)
+			return -EINVAL;
+		WRITE_ONCE(lp->rx_copybreak, copybreak);
+		return 0;
+	case ETHTOOL_TX_COPYBREAK:
+		copybreak = *(const u32 *)data;
+		if (copybreak > TX_COPYBREAK_MAX)
+			return -EINVAL;
+		WRITE_ONCE(lp->tx_copybreak, copybreak);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int adi_msp_get_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = lp->rx_coal_usecs;
+	ec->rx_max_coalesced_frames = lp->rx_coal_frames;
+	ec->tx_coalesce_usecs = lp->tx_coal_usecs;
+	ec->use_adaptive_rx_coalesce = lp->rx_dim_enabled;
+	ec->stats_block_coalesce_usecs = lp->hw_stats_usecs;
+
+	return 0;
+}
+
+static int adi_msp_set_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	if (ec->rx_coalesce_usecs > ADI_MSP_MAX_COAL_USECS ||
+	    ec->tx_coalesce_usecs > ADI_MSP_MAX_COAL_USECS)
+		return -EINVAL;
+
+	/* A poll never handles more than its budget */
+	if (ec->rx_max_coalesced_frames > NAPI_POLL_WEIGHT)
+		return -EINVAL;
 
-	for (i = 0; i < num; i++) {
-		data[i] = readl(lp->async_fifo_rx_regs + offsets[i]);
-		if (offsets[i] == 0x10)
-			data[i] &= 0x7fffffff;
+	if (ec->stats_block_coalesce_usecs > ADI_MSP_MAX_STATS_USECS)
+		return -EINVAL;
+
+	/* The work must keep running, or 32-bit counters could wrap unnoticed */
+	if (!ec->stats_block_coalesce_usecs) {
+		MSP_ERR("%s: stats-block-usecs cannot be 0\n", dev->name);
+		return -EINVAL;
 	}
-}
-#endif
 
-static void fill_msp_rx_stats(struct adi_msp_private *lp)
-{
-	u64 *data = (u64 *)&lp->stats.msp_rx;
-	int num = ARRAY_SIZE(adi_msp_rx_stats_offsets);
-	const int *offsets = adi_msp_rx_stats_offsets;
-	int i;
+	WRITE_ONCE(lp->rx_coal_usecs, ec->rx_coalesce_usecs);
+	WRITE_ONCE(lp->rx_coal_frames, ec->rx_max_coalesced_frames);
+	WRITE_ONCE(lp->tx_coal_usecs, ec->tx_coalesce_usecs);
+	WRITE_ONCE(lp->rx_dim_enabled, !!ec->use_adaptive_rx_coalesce);
 
-	for (i = 0; i < num; i++)
-		data[i] = readl((void __iomem *)(lp->rx_regs) + offsets[i]);
+	/* Collect once now, so the new interval takes effect at once */
+	if (ec->stats_block_coalesce_usecs != lp->hw_stats_usecs) {
+		WRITE_ONCE(lp->hw_stats_usecs, ec->stats_block_coalesce_usecs);
+		mod_delayed_work(system_wq, &lp->hw_stats_work, 0);
+	}
+
+	return 0;
 }
 
-static void adi_msp_get_ethtool_stats(struct net_device *dev,
-				      struct ethtool_stats *stats, u64 *data)
+static void adi_msp_get_ringparam(struct net_device *dev,
+				  struct ethtool_ringparam *ring)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
 
-	fill_intel_etile_tx_stats(lp);
-	fill_intel_etile_rx_stats(lp);
-	fill_bridge_mac_oif_stats(lp);
-	fill_oif_tx_stats(lp);
-	fill_oif_rx_stats(lp);
-#ifndef CONFIG_ADI_MSPRX_ASYNC_FIFO
-	fill_async_fifo_rx_stats(lp);
-#endif
-	fill_msp_rx_stats(lp);
-
-	memcpy(data, &lp->stats, sizeof(lp->stats));
+	ring->rx_max_pending = ADI_MSP_MAX_NUM_DS;
+	ring->tx_max_pending = ADI_MSP_MAX_NUM_DS;
+	ring->rx_pending = lp->num_rds;
+	ring->tx_pending = lp->num_tds;
 }
 
-static int adi_msp_get_ts_info(struct net_device *dev,
-			       struct ethtool_ts_info *info)
+/* Sizes are rounded up to powers of two. Rings are allocated when the
+ * interface is opened, so a running interface is restarted.
+ */
+static int adi_msp_set_ringparam(struct net_device *dev,
+				 struct ethtool_ringparam *ring)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
+	bool running = netif_running(dev);
+	u32 num_rds, num_tds, old_num_rds, old_num_tds;
+	int ret;
 
-	if (lp->has_ptp) {
-		info->phc_index = ptp_clock_index(lp->ptp_clk);
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
 
-		info->so_timestamping = SOF_TIMESTAMPING_TX_HARDWARE |
-					SOF_TIMESTAMPING_RX_HARDWARE |
-					SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (ring->rx_pending < ADI_MSP_MIN_NUM_DS ||
+	    ring->rx_pending > ADI_MSP_MAX_NUM_DS ||
+	    ring->tx_pending < ADI_MSP_MIN_NUM_DS ||
+	    ring->tx_pending > ADI_MSP_MAX_NUM_DS) {
+		MSP_ERR("%s: ring sizes must be between %d and %d\n",
+			dev->name, ADI_MSP_MIN_NUM_DS, ADI_MSP_MAX_NUM_DS);
+		return -EINVAL;
+	}
 
-		info->tx_types = (1 << HWTSTAMP_TX_OFF) |
-				 (1 << HWTSTAMP_TX_ON);
+	num_rds = roundup_pow_of_two(ring->rx_pending);
+	num_tds = roundup_pow_of_two(ring->tx_pending);
+	if (num_rds == lp->num_rds && num_tds == lp->num_tds)
+		return 0;
 
-		info->rx_filters = (1 << HWTSTAMP_FILTER_NONE) |
-				   (1 << HWTSTAMP_FILTER_ALL);
+	MSP_DBG("%s: change rings from %u/%u to %u/%u\n", dev->name,
+		lp->num_rds, lp->num_tds, num_rds, num_tds);
+
+	if (running) {
+		netif_tx_disable(dev);
+		adi_msp_close(dev);
+	}
+
+	old_num_rds = lp->num_rds;
+	old_num_tds = lp->num_tds;
+	lp->num_rds = num_rds;
+	lp->num_tds = num_tds;
 
+	if (!running)
 		return 0;
-	} else {
-		return ethtool_op_get_ts_info(dev, info);
+
+	ret = adi_msp_open(dev);
+	if (ret) {
+		lp->num_rds = old_num_rds;
+		lp->num_tds = old_num_tds;
+		adi_msp_reopen(dev);
 	}
+
+	return ret;
 }
 
 static const struct ethtool_ops netdev_ethtool_ops = {
+	.supported_coalesce_params = ETHTOOL_COALESCE_USECS |
+				     ETHTOOL_COALESCE_RX_MAX_FRAMES |
+				     ETHTOOL_COALESCE_USE_ADAPTIVE_RX |
+				     ETHTOOL_COALESCE_STATS_BLOCK_USECS,
 	.get_drvinfo		= adi_msp_get_drvinfo,
 	.get_ethtool_stats	= adi_msp_get_ethtool_stats,
 	.get_strings		= adi_msp_get_strings,
 	.get_sset_count		= adi_msp_get_sset_count,
 	.get_ts_info		= adi_msp_get_ts_info,
+	.get_pause_stats	= adi_msp_get_pause_stats,
+	.get_tunable		= adi_msp_get_tunable,
+	.set_tunable		= adi_msp_set_tunable,
+	.get_coalesce		= adi_msp_get_coalesce,
+	.set_coalesce		= adi_msp_set_coalesce,
+	.get_ringparam		= adi_msp_get_ringparam,
+	.set_ringparam		= adi_msp_set_ringparam,
 };
 
-static int adi_msp_alloc_ring(struct net_device *dev)
+/* Initialize the transmit and the transmit status descriptors. Also used
+ * to rebuild them when Tx is reset.
+ */
+static void adi_msp_init_tx_ring(struct adi_msp_private *lp)
 {
-	struct adi_msp_private *lp = netdev_priv(dev);
-	struct sk_buff *skb;
-	dma_addr_t as; // addrstart
 	int i;
 
 	/* Initialize the transmit descriptors */
-	for (i = 0; i < ADI_MSP_NUM_TDS; i++) {
+	for (i = 0; i < lp->num_tds; i++) {
 		lp->td_ring[i].dscptr_nxt = 0;
 		lp->td_ring[i].addrstart = 0;
 		lp->td_ring[i].cfg = 0;
 		lp->td_ring[i].xcnt = 0;
 		lp->td_ring[i].xmod = 0;
+		lp->tx_buf[i].dma_len = 0;
+		lp->tx_buf[i].pending = 0;
+		lp->tx_buf[i].xsk = false;
 	}
 	lp->tx_next_done = 0;
+	lp->td_next_done = 0;
 	lp->tx_chain_head = 0;
 	lp->tx_chain_tail = 0;
 	atomic_set(&lp->tx_count, 0);
+	atomic_set(&lp->tx_next_use, 0);
 	lp->tx_chain_status = EMPTY;
 
+	/* Initialize the transmit status descriptors */
+
+	for (i = 0; i < ADI_MSP_NUM_SDS(lp); i++) {
+		lp->sd_ring[i].cfg = STATUS_DMA_CFG_COMMON;
+		lp->sd_ring[i].cfg |= (i == ADI_MSP_NUM_SDS(lp) - 1) ?
+			DMA_CFG_FLOW_STOP : DMA_CFG_FLOW_DSCL;
+		lp->sd_ring[i].xcnt = STATUS_WU_LEN / STATUS_XMOD;
+		lp->sd_ring[i].xmod = STATUS_XMOD;
+		lp->sd_ring[i].addrstart = adi_msp_status_wu_dma(lp, i);
+		lp->sd_ring[i].dscptr_nxt = adi_msp_status_dma(lp, i + 1);
+	}
+}
+
+/* Free the frames left in Tx ring and return how many there were */
+static int adi_msp_free_tx_ring(struct adi_msp_private *lp)
+{
+	int i, count = 0, xsk_frames = 0;
+
+	for (i = 0; i < lp->num_tds; i++) {
+		lp->td_ring[i].cfg = 0;
+		lp->td_ring[i].xcnt = 0;
+
+		if (lp->tx_buf[i].skb) {
+			adi_msp_unmap_tx_skb(lp, i, lp->tx_buf[i].descs);
+			dev_kfree_skb_any(lp->tx_buf[i].skb);
+			lp->tx_buf[i].skb = NULL;
+			count++;
+		}
+
+		if (lp->tx_buf[i].xdpf) {
+			adi_msp_unmap_tx_skb(lp, i, lp->tx_buf[i].descs);
+			xdp_return_frame(lp->tx_buf[i].xdpf);
+			lp->tx_buf[i].xdpf = NULL;
+			count++;
+		}
+
+		if (lp->tx_buf[i].xsk) {
+			lp->tx_buf[i].xsk = false;
+			xsk_frames++;
+			count++;
+		}
+	}
+
+	/* AF_XDP socket only counts completions, so unsent frames go back
+	 * the same way
+	 */
+	if (xsk_frames)
+		xsk_tx_completed(lp->xsk_pool, xsk_frames);
+
+	for (i = 0; i < ADI_MSP_NUM_SDS(lp); i++) {
+		lp->sd_ring[i].cfg = 0;
+		lp->sd_ring[i].xcnt = 0;
+	}
+
+	return count;
+}
+
+static void adi_msp_free_ring_bufs(struct adi_msp_private *lp)
+{
+	if (lp->td_ring)
+		dma_free_coherent(lp->dmadev, lp->num_tds * sizeof(struct dma_desc),
+				  lp->td_ring, lp->td_dma);
+	if (lp->rd_ring)
+		dma_free_coherent(lp->dmadev, lp->num_rds * sizeof(struct dma_desc),
+				  lp->rd_ring, lp->rd_dma);
+	if (lp->sd_ring)
+		dma_free_coherent(lp->dmadev,
+				  ADI_MSP_NUM_SDS(lp) * sizeof(struct dma_desc),
+				  lp->sd_ring, lp->sd_dma);
+	if (lp->status_wu)
+		dma_free_coherent(lp->dmadev,
+				  ADI_MSP_NUM_SDS(lp) * STATUS_WU_BUF_SIZE,
+				  lp->status_wu, lp->status_wu_dma);
+	lp->td_ring = NULL;
+	lp->rd_ring = NULL;
+	lp->sd_ring = NULL;
+	lp->status_wu = NULL;
+	if (lp->tx_bounce)
+		dma_free_coherent(lp->dmadev, lp->num_tds * TX_BOUNCE_BUF_SIZE,
+				  lp->tx_bounce, lp->tx_bounce_dma);
+	lp->tx_bounce = NULL;
+
+	kfree(lp->tx_buf);
+	kfree(lp->rx_buf);
+	kfree(lp->tx_time);
+	lp->tx_buf = NULL;
+	lp->rx_buf = NULL;
+	lp->tx_time = NULL;
+}
+
+/* Allocate descriptor rings, Tx status work units, bounce buffers and the
+ * arrays indexed by descriptor for the current ring sizes. All or nothing.
+ */
+static int adi_msp_alloc_ring_bufs(struct adi_msp_private *lp)
+{
+	u32 nr = lp->num_rds, nt = lp->num_tds, ns = ADI_MSP_NUM_SDS(lp);
+	bool lat;
+
+	BUILD_BUG_ON(sizeof(struct adi_msp_tx_buf) > 32);
+
+	lp->td_ring = dma_alloc_coherent(lp->dmadev, nt * sizeof(struct dma_desc),
+					 &lp->td_dma, GFP_KERNEL);
+	lp->rd_ring = dma_alloc_coherent(lp->dmadev, nr * sizeof(struct dma_desc),
+					 &lp->rd_dma, GFP_KERNEL);
+	lp->sd_ring = dma_alloc_coherent(lp->dmadev, ns * sizeof(struct dma_desc),
+					 &lp->sd_dma, GFP_KERNEL);
+	lp->status_wu = dma_alloc_coherent(lp->dmadev, ns * STATUS_WU_BUF_SIZE,
+					   &lp->status_wu_dma, GFP_KERNEL);
+	lp->tx_bounce = dma_alloc_coherent(lp->dmadev, nt * TX_BOUNCE_BUF_SIZE,
+					   &lp->tx_bounce_dma, GFP_KERNEL);
+
+	lp->tx_buf = kcalloc(nt, sizeof(*lp->tx_buf), GFP_KERNEL);
+	lp->rx_buf = kcalloc(nr, sizeof(*lp->rx_buf), GFP_KERNEL);
+	lat = READ_ONCE(latency_stats);
+	if (lat)
+		lp->tx_time = kcalloc(nt, sizeof(*lp->tx_time), GFP_KERNEL);
+
+	if (!lp->td_ring || !lp->rd_ring || !lp->sd_ring || !lp->status_wu ||
+	    !lp->tx_bounce || !lp->tx_buf || !lp->rx_buf ||
+	    (lat && !lp->tx_time)) {
+		adi_msp_free_ring_bufs(lp);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int adi_msp_alloc_ring(struct net_device *dev)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = PP_FLAG_DMA_MAP,
+		.pool_size = lp->num_rds,
+		.nid = NUMA_NO_NODE,
+		.dev = lp->dmadev,
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+	int i;
+
+	if (adi_msp_alloc_ring_bufs(lp))
+		return -ENOMEM;
+
+	adi_msp_init_tx_ring(lp);
+
 	/* Initialize the receive descriptors */
-	for (i = 0; i < ADI_MSP_NUM_RDS; i++) {
-		skb = napi_alloc_skb(&lp->rx_napi, RX_WU_BUF_SIZE);
-		if (!skb)
+	lp->rx_page_pool = page_pool_create(&pp_params);
+	if (IS_ERR(lp->rx_page_pool)) {
+		lp->rx_page_pool = NULL;
+		return -ENOMEM;
+	}
+
+	if (xdp_rxq_info_reg(&lp->xdp_rxq, dev, 0))
+		return -ENOMEM;
+	if (xdp_rxq_info_reg_mem_model(&lp->xdp_rxq, MEM_TYPE_PAGE_POOL,
+				       lp->rx_page_pool))
+		return -ENOMEM;
+
+	/* Buffers of AF_XDP socket carry xsk_rxq in their xdp_buff */
+	if (lp->xsk_pool) {
+		if (xdp_rxq_info_reg(&lp->xsk_rxq, dev, 0))
+			return -ENOMEM;
+		if (xdp_rxq_info_reg_mem_model(&lp->xsk_rxq,
+					       MEM_TYPE_XSK_BUFF_POOL, NULL))
+			return -ENOMEM;
+		xsk_pool_set_rxq_info(lp->xsk_pool, &lp->xsk_rxq);
+	}
+
+	for (i = 0; i < lp->num_rds; i++) {
+		if (adi_msp_rx_refill(lp, i))
 			return -ENOMEM;
-		if (((unsigned long long)skb->data) & 0x7)
-			pr_info("not aligned to 8\n");
-		/* Initialize work unit header byte to 0 */
-		skb->data[0] = 0;
-		lp->rx_skb[i] = skb;
 
 		lp->rd_ring[i].cfg = RX_DMA_CFG_COMMON;
 #if 1
-		lp->rd_ring[i].cfg |= (i == ADI_MSP_NUM_RDS - 1) ?
+		lp->rd_ring[i].cfg |= (i == lp->num_rds - 1) ?
 			DMA_CFG_FLOW_STOP : DMA_CFG_FLOW_DSCL;
 #else
 		/*
@@ -2182,31 +4602,13 @@ static int adi_msp_alloc_ring(struct net_device *dev)
 #endif
 		lp->rd_ring[i].xcnt = RX_WU_LEN / RX_XMOD;
 		lp->rd_ring[i].xmod = RX_XMOD;
-
-		as = dma_map_single(lp->dmadev, skb->data, RX_WU_LEN,
-				    DMA_FROM_DEVICE);
-		if (dma_mapping_error(lp->dmadev, as))
-			return -ENOMEM;
-		lp->rd_ring[i].addrstart = as;
-		lp->rx_skb_dma[i] = as;
+		lp->rd_ring[i].addrstart = lp->rx_buf[i].dma;
 
 		lp->rd_ring[i].dscptr_nxt = adi_msp_rx_dma(lp, i + 1);
 	}
 
 	lp->rx_next_done  = 0;
 
-	/* Initialize the transmit status descriptors */
-
-	for (i = 0; i < ADI_MSP_NUM_SDS; i++) {
-		lp->sd_ring[i].cfg = STATUS_DMA_CFG_COMMON;
-		lp->sd_ring[i].cfg |= (i == ADI_MSP_NUM_SDS - 1) ?
-			DMA_CFG_FLOW_STOP : DMA_CFG_FLOW_DSCL;
-		lp->sd_ring[i].xcnt = STATUS_WU_LEN / STATUS_XMOD;
-		lp->sd_ring[i].xmod = STATUS_XMOD;
-		lp->sd_ring[i].addrstart = adi_msp_status_wu_dma(lp, i);
-		lp->sd_ring[i].dscptr_nxt = adi_msp_status_dma(lp, i + 1);
-	}
-
 	return 0;
 }
 
@@ -2215,91 +4617,245 @@ static void adi_msp_free_ring(struct net_device *dev)
 	struct adi_msp_private *lp = netdev_priv(dev);
 	int i;
 
-	for (i = 0; i < ADI_MSP_NUM_RDS; i++) {
+	/* Nothing else has been allocated */
+	if (!lp->td_ring)
+		return;
+
+	/* XDP_TX frames go back to the page pool, so free Tx ring first */
+	adi_msp_free_tx_ring(lp);
+
+	for (i = 0; i < lp->num_rds; i++) {
 		lp->rd_ring[i].cfg = 0;
 		lp->rd_ring[i].xcnt = 0;
-		if (lp->rx_skb[i]) {
-			dma_unmap_single(lp->dmadev, lp->rx_skb_dma[i],
-					 RX_WU_LEN, DMA_FROM_DEVICE);
-			dev_kfree_skb_any(lp->rx_skb[i]);
-			lp->rx_skb[i] = NULL;
+		if (lp->rx_buf[i].xsk) {
+			xsk_buff_free(lp->rx_buf[i].xdp);
+			lp->rx_buf[i].xdp = NULL;
+			lp->rx_buf[i].xsk = false;
+		} else if (lp->rx_buf[i].page) {
+			page_pool_put_full_page(lp->rx_page_pool, lp->rx_buf[i].page,
+						false);
+			lp->rx_buf[i].page = NULL;
 		}
 	}
 
-	for (i = 0; i < ADI_MSP_NUM_TDS; i++) {
-		lp->td_ring[i].cfg = 0;
-		lp->td_ring[i].xcnt = 0;
+	for (i = 0; i < lp->prev_rx_page_count; i++) {
+		if (lp->prev_rx_xsk[i])
+			xsk_buff_free(lp->prev_rx_xsk[i]);
+		else
+			page_pool_put_full_page(lp->rx_page_pool,
+						lp->prev_rx_page[i], false);
+		lp->prev_rx_page[i] = NULL;
+		lp->prev_rx_xsk[i] = NULL;
+	}
+	lp->prev_rx_page_count = 0;
 
-		if (lp->tx_skb[i]) {
-#ifdef CONFIG_ADI_MSP_TX_PADDING
-			u32 frame_length = max(lp->tx_skb[i]->len, TX_MIN_FRAME_SIZE);
-#else
-			u32 frame_length = lp->tx_skb[i]->len;
-#endif
+	if (xdp_rxq_info_is_reg(&lp->xdp_rxq))
+		xdp_rxq_info_unreg(&lp->xdp_rxq);
+	if (xdp_rxq_info_is_reg(&lp->xsk_rxq))
+		xdp_rxq_info_unreg(&lp->xsk_rxq);
+	page_pool_destroy(lp->rx_page_pool);
+	lp->rx_page_pool = NULL;
 
-#ifdef CONFIG_ADI_MSP_WA_TX_WU_SIZE_MULTIPLE_OF_8
-			u32 wu_length = round_up(frame_length + TX_WU_HEADER_LEN, 8);
-#else
-			u32 wu_length = frame_length + TX_WU_HEADER_LEN;
-#endif
+	adi_msp_free_ring_bufs(lp);
+}
 
-			dma_unmap_single(lp->dmadev, lp->tx_skb_dma[i],
-					 wu_length, DMA_TO_DEVICE);
-			dev_kfree_skb_any(lp->tx_skb[i]);
-			lp->tx_skb[i] = NULL;
-		}
-	}
+/* Netdev of the other port, NULL if it is not exposed */
+static inline struct net_device *adi_msp_other_dev(struct adi_msp_private *lp)
+{
+	return lp->port_dev[lp->port ^ 1];
+}
 
-	for (i = 0; i < ADI_MSP_NUM_SDS; i++) {
-		lp->sd_ring[i].cfg = 0;
-		lp->sd_ring[i].xcnt = 0;
-	}
+/* Both ports share MIN/MAX frame size registers, which are set for the
+ * larger MTU
+ */
+static int adi_msp_frame_mtu(struct adi_msp_private *lp)
+{
+	struct net_device *other = adi_msp_other_dev(lp);
+
+	if (other)
+		return max(lp->dev->mtu, other->mtu);
+
+	return lp->dev->mtu;
 }
 
-static void adi_msp_tx_timeout(struct net_device *dev, unsigned int txqueue)
+static void adi_msp_init_tx_regs(struct adi_msp_private *lp)
 {
-	MSP_ERR("%s: Entering %s ...\n", dev->name, __func__);
-#if 0
-	struct adi_msp_private *lp = netdev_priv(dev);
+	u32 frame_size;
+
+	writel(TX_TIMEOUT_VALUE, &lp->tx_regs->timeout_value);
+
+	frame_size = TX_MIN_FRAME_SIZE | TX_MAX_FRAME_SIZE(adi_msp_frame_mtu(lp)) << 16;
+	writel(frame_size, &lp->tx_regs->frame_size);
+
+	writel(MSP_TX_INT_ALL, &lp->tx_regs->intr_en);
+}
+
+static void adi_msp_start_status_dma(struct adi_msp_private *lp)
+{
+	u32 dma_cfg = STATUS_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL;
+
+	lp->status_stale_dscptr = adi_msp_stale_dscptr(lp->status_dma_regs);
+	writel(adi_msp_status_dma(lp, 0), &lp->status_dma_regs->dscptr_nxt);
+	writel(dma_cfg, &lp->status_dma_regs->cfg);
+}
+
+/* FIXME  Is there a bit telling us that reset is done? */
+static void adi_msp_reset_tx(struct adi_msp_private *lp)
+{
+	u32 rst_ctrl;
+
+	if (!lp->rst_ctrl)
+		return;
+
+	rst_ctrl = readl(lp->rst_ctrl);
+	writel(rst_ctrl & ~lp->rst_ctrl_tx, lp->rst_ctrl);
+	writel(rst_ctrl | lp->rst_ctrl_tx, lp->rst_ctrl);
+}
+
+/* Recover Tx when Tx status work units go out of sync with Tx work units,
+ * or Tx DMA, Tx status DMA or a Tx queue gets stuck. Both NAPIs are stopped,
+ * MSP Tx is reset and Tx and Tx status DMAs are restarted with empty rings.
+ * Frames in flight are dropped. Rx DMA keeps running, so nothing received
+ * meanwhile is lost unless Rx ring fills up.
+ */
+static void adi_msp_tx_reset_work(struct work_struct *work)
+{
+	struct adi_msp_private *lp =
+		container_of(work, struct adi_msp_private, tx_reset_work);
 	struct net_device *dev = lp->dev;
-	u32 tmp;
+	struct net_device *other = adi_msp_other_dev(lp);
+	ktime_t start;
+	u64 usecs;
+	int i, dropped;
 
-	/*
-	 * Disable interrupts
+	rtnl_lock();
+	if (!netif_running(dev))
+		goto out;
+
+	start = ktime_get();
+
+	/* ndo_xdp_xmit checks this with Tx queue lock held. Once Tx queues
+	 * are disabled, nothing touches Tx chain but Tx status NAPI.
 	 */
+	WRITE_ONCE(lp->tx_resetting, true);
+	netif_tx_disable(dev);
+	if (other)
+		netif_tx_disable(other);
+
 	disable_irq(lp->rx_dmadone_irq);
-	disable_irq(lp->rx_dde_error_irq);
-	disable_irq(lp->tx_dmadone_irq);
 	disable_irq(lp->tx_dde_error_irq);
+	disable_irq(lp->status_dmadone_irq);
+	disable_irq(lp->status_dde_error_irq);
+
+	napi_disable(&lp->rx_napi);
+	napi_disable(&lp->status_napi);
+	hrtimer_cancel(&lp->rx_coal_timer);
+	hrtimer_cancel(&lp->status_coal_timer);
 
-	tmp = readl(&lp->tx_dma_regs->cfg);
-	tmp &= ~DMA_CFG_INT_MASK;
-	writel(tmp, &lp->tx_dma_regs->cfg);
+	writel(0, &lp->tx_regs->stat_ctrl);
+	writel(0, &lp->tx_dma_regs->cfg);
+	writel(0, &lp->status_dma_regs->cfg);
 
-	tmp = readl(&lp->rx_dma_regs->cfg);
-	tmp &= ~DMA_CFG_INT_MASK;
-	writel(tmp, &lp->rx_dma_regs->cfg);
+	adi_msp_reset_tx(lp);
+	adi_msp_init_tx_regs(lp);
 
-	napi_disable(&lp->tx_napi);
+	dropped = adi_msp_free_tx_ring(lp);
+	adi_msp_init_tx_ring(lp);
+	memset(lp->status_wu, 0, ADI_MSP_NUM_SDS(lp) * STATUS_WU_BUF_SIZE);
+	adi_msp_init_frame_tags(lp);
+	WRITE_ONCE(lp->tx_reset_pending, false);
 
-	adi_msp_free_ring(dev);
+	writel(DMA_STAT_IRQDONE | DMA_STAT_IRQERR, &lp->tx_dma_regs->stat);
+	writel(DMA_STAT_IRQDONE | DMA_STAT_IRQERR, &lp->status_dma_regs->stat);
+	adi_msp_start_status_dma(lp);
+	writel(MSP_EN, &lp->tx_regs->stat_ctrl);
 
-	if (adi_msp_init(dev) < 0) {
-		printk(KERN_ERR "%s: cannot restart device\n", dev->name);
-		return;
+	atomic64_add(dropped, &lp->tx_dropped[lp->port]);
+	for (i = 0; i < ADI_MSP_NUM_TXQS; i++) {
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+		if (other)
+			netdev_tx_reset_queue(netdev_get_tx_queue(other, i));
 	}
 
-	enable_irq(lp->rx_dmadone_irq);
-	enable_irq(lp->rx_dde_error_irq);
-	enable_irq(lp->tx_dmadone_irq);
+	napi_enable(&lp->rx_napi);
+	napi_enable(&lp->status_napi);
+
+	/* NAPI might have left DMA done interrupts masked for the timers */
+	adi_msp_enable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+	adi_msp_enable_status_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+
+	enable_irq(lp->status_dde_error_irq);
+	enable_irq(lp->status_dmadone_irq);
 	enable_irq(lp->tx_dde_error_irq);
-#endif
-	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
+	enable_irq(lp->rx_dmadone_irq);
+
+	WRITE_ONCE(lp->tx_resetting, false);
+	netif_tx_wake_all_queues(dev);
+	if (other && netif_running(other))
+		netif_tx_wake_all_queues(other);
+
+	usecs = ktime_us_delta(ktime_get(), start);
+	lp->stats.tx_reset.done++;
+	lp->stats.tx_reset.last_usecs = usecs;
+	if (usecs > lp->stats.tx_reset.max_usecs)
+		lp->stats.tx_reset.max_usecs = usecs;
+
+	MSP_ERR("%s: MSP Tx reset in %llu us, %d frames dropped\n",
+		dev->name, usecs, dropped);
+out:
+	rtnl_unlock();
+}
+
+/* Called with Tx queue locks held, so only schedule the reset */
+static void adi_msp_tx_timeout(struct net_device *dev, unsigned int txqueue)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+
+	MSP_ERR("%s: Tx queue %u timed out\n", dev->name, txqueue);
+
+	atomic64_inc(&lp->tx_errors[lp->port]);
+	adi_msp_schedule_tx_reset(lp);
+}
+
+static void adi_msp_set_irq_hint(int irq, int cpu, bool set)
+{
+	if (cpu >= 0)
+		irq_set_affinity_hint(irq, set ? cpumask_of(cpu) : NULL);
+}
+
+/* Set or clear affinity hints. They must be cleared before free_irq(). */
+static void adi_msp_set_irq_affinity(struct adi_msp_private *lp, bool set)
+{
+	adi_msp_set_irq_hint(lp->rx_dmadone_irq, lp->rx_irq_cpu, set);
+	adi_msp_set_irq_hint(lp->rx_dde_error_irq, lp->rx_irq_cpu, set);
+	adi_msp_set_irq_hint(lp->tx_dde_error_irq, lp->tx_irq_cpu, set);
+	adi_msp_set_irq_hint(lp->status_dmadone_irq, lp->status_irq_cpu, set);
+	adi_msp_set_irq_hint(lp->status_dde_error_irq, lp->status_irq_cpu, set);
+}
+
+/* Netdev of the other port runs its Tx queues only while lp->dev is up,
+ * since the rings are allocated on open. Its carrier follows lp->dev.
+ */
+static void adi_msp_port_start(struct net_device *dev)
+{
+	int i;
+
+	for (i = 0; i < ADI_MSP_NUM_TXQS; i++)
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+	netif_carrier_on(dev);
+	netif_tx_wake_all_queues(dev);
+}
+
+static void adi_msp_port_stop(struct net_device *dev)
+{
+	netif_tx_disable(dev);
+	netif_carrier_off(dev);
 }
 
 static int adi_msp_open(struct net_device *dev)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
+	struct net_device *other = adi_msp_other_dev(lp);
 	u32 frame_size, dma_cfg;
 	int i, ret;
 
@@ -2309,16 +4865,14 @@ static int adi_msp_open(struct net_device *dev)
 	writel(0, &lp->tx_regs->stat_ctrl);
 	writel(0, &lp->rx_regs->stat_ctrl);
 
-	writel(TX_TIMEOUT_VALUE, &lp->tx_regs->timeout_value);
+	/* Set timeout and MIN/MAX frame size, enable all MSP Tx interrupts */
+	adi_msp_init_tx_regs(lp);
 
 	/* Set MIN/MAX frame size */
-	frame_size = TX_MIN_FRAME_SIZE | TX_MAX_FRAME_SIZE << 16;
-	writel(frame_size, &lp->tx_regs->frame_size);
-	frame_size = RX_MIN_FRAME_SIZE | RX_MAX_FRAME_SIZE << 16;
+	frame_size = RX_MIN_FRAME_SIZE | RX_MAX_FRAME_SIZE(adi_msp_frame_mtu(lp)) << 16;
 	writel(frame_size, &lp->rx_regs->frame_size);
 
-	/* Enable all MSP Tx/Rx interrupts */
-	writel(MSP_TX_INT_ALL, &lp->tx_regs->intr_en);
+	/* Enable all MSP Rx interrupts */
 	writel(MSP_RX_INT_ALL, &lp->rx_regs->intr_en);
 
 	/* Make sure DMAs are disabled */
@@ -2333,19 +4887,15 @@ static int adi_msp_open(struct net_device *dev)
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < PREV_RX_SKB_NUM; i++)
-		lp->prev_rx_skb[i] = NULL;
-	lp->prev_rx_skb_count = 0;
-
-	lp->next_nonptp_frame_tag = ADI_MSP_MIN_NONPTP_FRAME_TAG;
-	lp->last_nonptp_frame_tag = ADI_MSP_MAX_NONPTP_FRAME_TAG;
-	atomic_set(&lp->available_nonptp_frame_tag_count,
-		   lp->last_nonptp_frame_tag - lp->next_nonptp_frame_tag + 1);
+	for (i = 0; i < PREV_RX_PAGE_NUM; i++) {
+		lp->prev_rx_page[i] = NULL;
+		lp->prev_rx_xsk[i] = NULL;
+	}
+	lp->prev_rx_page_count = 0;
 
-	lp->next_ptp_frame_tag = ADI_MSP_MIN_PTP_FRAME_TAG;
-	lp->last_ptp_frame_tag = ADI_MSP_MAX_PTP_FRAME_TAG;
-	atomic_set(&lp->available_ptp_frame_tag_count,
-		   lp->last_ptp_frame_tag - lp->next_ptp_frame_tag + 1);
+	adi_msp_init_frame_tags(lp);
+	/* A reset scheduled while dev was down is not done */
+	WRITE_ONCE(lp->tx_reset_pending, false);
 
 	ret = request_irq(lp->rx_dmadone_irq, adi_msp_rx_dma_done_interrupt,
 			  0, "ADI MSP Rx DMA done", dev);
@@ -2387,10 +4937,16 @@ static int adi_msp_open(struct net_device *dev)
 		goto err_free_irq_5;
 	}
 
+	adi_msp_set_irq_affinity(lp, true);
+
+	/* Rx DMA done interrupt masks itself even when NAPI cannot be
+	 * scheduled, so NAPIs must be ready before any DMA is started
+	 */
+	napi_enable(&lp->rx_napi);
+	napi_enable(&lp->status_napi);
+
 	/* Start Tx status DMA */
-	dma_cfg = STATUS_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL;
-	writel(adi_msp_status_dma(lp, 0), &lp->status_dma_regs->dscptr_nxt);
-	writel(dma_cfg, &lp->status_dma_regs->cfg);
+	adi_msp_start_status_dma(lp);
 
 	/* Start MSP Tx interface */
 	writel(MSP_EN, &lp->tx_regs->stat_ctrl);
@@ -2400,16 +4956,21 @@ static int adi_msp_open(struct net_device *dev)
 
 	/* Start Rx DMA */
 	dma_cfg = RX_DMA_CFG_COMMON | DMA_CFG_FLOW_DSCL;
+	lp->rx_stale_dscptr = adi_msp_stale_dscptr(lp->rx_dma_regs);
 	writel(adi_msp_rx_dma(lp, 0), &lp->rx_dma_regs->dscptr_nxt);
 	writel(dma_cfg, &lp->rx_dma_regs->cfg);
 
 	/* Start MSP Rx interface */
 	writel(MSP_EN, &lp->rx_regs->stat_ctrl);
 
-	napi_enable(&lp->rx_napi);
-	napi_enable(&lp->status_napi);
+	for (i = 0; i < ADI_MSP_NUM_TXQS; i++)
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+	netif_tx_start_all_queues(dev);
+
+	if (other && netif_running(other))
+		adi_msp_port_start(other);
 
-	netif_start_queue(dev);
+	lp->opened = true;
 
 	MSP_DBG("%s: ... Leaving %s\n", dev->name, __func__);
 out:
@@ -2423,33 +4984,27 @@ err_free_irq_3:
 	free_irq(lp->rx_dde_error_irq, dev);
 err_free_irq_1:
 	free_irq(lp->rx_dmadone_irq, dev);
-err_release:
-	adi_msp_free_ring(dev);
-	goto out;
-}
-
-#if 0
-static void adi_msp_reset(struct net_device *dev)
-{
-	u32 rst_ctrl;
-
-	/* FIXME  For now we only handle Tx0 and Rx0 */
-	rst_ctrl = readl(MSP_RST_CTRL);
-	rst_ctrl &= ~(MSP_RST_CTRL_TX0 | MSP_RST_CTRL_RX0);
-	writel(rst_ctrl, MSP_RST_CTRL);
-	rst_ctrl |= MSP_RST_CTRL_TX0 | MSP_RST_CTRL_RX0;
-	writel(rst_ctrl, MSP_RST_CTRL);
-	/* FIXME  Is there a bit telling us that reset is done? */
+err_release:
+	adi_msp_free_ring(dev);
+	goto out;
 }
-#endif
 
 static int adi_msp_close(struct net_device *dev)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
-	int i;
+	struct net_device *other = adi_msp_other_dev(lp);
 
 	MSP_DBG("%s: Entering %s ...\n", dev->name, __func__);
 
+	/* Already torn down by a failed reopen */
+	if (!lp->opened)
+		return 0;
+	lp->opened = false;
+
+	/* Rings are about to be freed */
+	if (other)
+		adi_msp_port_stop(other);
+
 	/* Make sure MSP Tx and Rx interfaces are disabled */
 	writel(0, &lp->tx_regs->stat_ctrl);
 	writel(0, &lp->rx_regs->stat_ctrl);
@@ -2469,13 +5024,17 @@ static int adi_msp_close(struct net_device *dev)
 	napi_disable(&lp->rx_napi);
 	napi_disable(&lp->status_napi);
 
-	adi_msp_free_ring(dev);
+	hrtimer_cancel(&lp->rx_coal_timer);
+	hrtimer_cancel(&lp->status_coal_timer);
+	cancel_work_sync(&lp->rx_dim.work);
+
+	/* Don't leave DMA done interrupts masked for the next open */
+	adi_msp_enable_rx_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
+	adi_msp_enable_status_dma_interrupts(lp, MSP_INT_CTRL_DMADONE);
 
-	for (i = 0; i < PREV_RX_SKB_NUM; i++)
-		if (lp->prev_rx_skb[i])
-			dev_kfree_skb_any(lp->prev_rx_skb[i]);
-	lp->prev_rx_skb_count = 0;
+	adi_msp_free_ring(dev);
 
+	adi_msp_set_irq_affinity(lp, false);
 	free_irq(lp->rx_dmadone_irq, dev);
 	free_irq(lp->rx_dde_error_irq, dev);
 	free_irq(lp->tx_dde_error_irq, dev);
@@ -2487,19 +5046,85 @@ static int adi_msp_close(struct net_device *dev)
 	return 0;
 }
 
+/* Reopen DEV with its old settings after adi_msp_open() failed with the
+ * new ones. If that fails too, DEV is brought down. Otherwise it would be
+ * left IFF_UP with no IRQs and NAPIs disabled.
+ */
+static void adi_msp_reopen(struct net_device *dev)
+{
+	if (!adi_msp_open(dev))
+		return;
+
+	MSP_ERR("%s: cannot reopen with old settings, bring it down\n",
+		dev->name);
+	dev_close(dev);
+}
+
+/* MIN/MAX frame size registers are only set when the interface is opened,
+ * so a running interface is restarted for the new MTU. Rx ring stays the
+ * same, jumbo frames just use more data work units.
+ */
+static int adi_msp_change_mtu(struct net_device *dev, int new_mtu)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	bool running = netif_running(dev);
+	int old_mtu = dev->mtu;
+	int ret;
+
+	MSP_DBG("%s: change MTU from %d to %d\n", dev->name, dev->mtu, new_mtu);
+
+	if ((READ_ONCE(lp->xdp_prog) || lp->xsk_pool) &&
+	    new_mtu > XDP_MAX_MTU) {
+		MSP_ERR("%s: MTU cannot be larger than %d with XDP program or AF_XDP socket\n",
+			dev->name, XDP_MAX_MTU);
+		return -EINVAL;
+	}
+
+	if (running) {
+		netif_tx_disable(dev);
+		adi_msp_close(dev);
+	}
+
+	dev->mtu = new_mtu;
+
+	if (!running)
+		return 0;
+
+	ret = adi_msp_open(dev);
+	if (ret) {
+		dev->mtu = old_mtu;
+		adi_msp_reopen(dev);
+	}
+
+	return ret;
+}
+
+static void adi_msp_fill_stats64(const struct adi_msp_nl_stats *nl,
+				 struct rtnl_link_stats64 *stats)
+{
+	stats->rx_packets	= nl->rx_packets;
+	stats->tx_packets	= nl->tx_packets;
+	stats->rx_bytes		= nl->rx_bytes;
+	stats->tx_bytes		= nl->tx_bytes;
+	stats->rx_errors	= nl->rx_errors;
+	stats->tx_errors	= nl->tx_errors;
+	stats->rx_dropped	= nl->rx_dropped;
+	stats->tx_dropped	= nl->tx_dropped;
+	stats->multicast	= nl->multicast;
+	stats->rx_length_errors	= nl->rx_length_errors;
+	stats->rx_crc_errors	= nl->rx_crc_errors;
+	stats->rx_fifo_errors	= nl->rx_fifo_errors;
+	stats->rx_missed_errors	= nl->rx_missed_errors;
+}
+
 static void adi_msp_get_stats64(struct net_device *dev,
 				struct rtnl_link_stats64 *stats)
 {
 	struct adi_msp_private *lp = netdev_priv(dev);
+	struct adi_msp_nl_stats nl;
 
-	stats->rx_packets	= lp->stats.nl.rx_packets;
-	stats->tx_packets	= lp->stats.nl.tx_packets;
-	stats->rx_bytes		= lp->stats.nl.rx_bytes;
-	stats->tx_bytes		= lp->stats.nl.tx_bytes;
-	stats->rx_errors	= lp->stats.nl.rx_errors;
-	stats->tx_errors	= lp->stats.nl.tx_errors;
-	stats->rx_dropped	= lp->stats.nl.rx_dropped;
-	stats->tx_dropped	= lp->stats.nl.tx_dropped;
+	adi_msp_get_nl_stats(lp, lp->port, &nl);
+	adi_msp_fill_stats64(&nl, stats);
 }
 
 static int adi_msp_hwtstamp_set(struct net_device *dev, struct ifreq *ifr)
@@ -2524,15 +5149,37 @@ static int adi_msp_hwtstamp_set(struct net_device *dev, struct ifreq *ifr)
 		return -ERANGE;
 	}
 
+	/* PTPv2 filters of single message types are widened to all event
+	 * messages. Other filters are widened to all frames.
+	 */
 	switch (config.rx_filter) {
 	case HWTSTAMP_FILTER_NONE:
-		lp->hwtstamp_rx_en = false;
+		lp->hwtstamp_rx_ptp = 0;
+		break;
+	case HWTSTAMP_FILTER_PTP_V2_L2_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_L2_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ:
+		lp->hwtstamp_rx_ptp = ADI_MSP_PTP_L2;
+		config.rx_filter = HWTSTAMP_FILTER_PTP_V2_L2_EVENT;
+		break;
+	case HWTSTAMP_FILTER_PTP_V2_L4_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_L4_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ:
+		lp->hwtstamp_rx_ptp = ADI_MSP_PTP_L4;
+		config.rx_filter = HWTSTAMP_FILTER_PTP_V2_L4_EVENT;
+		break;
+	case HWTSTAMP_FILTER_PTP_V2_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_DELAY_REQ:
+		lp->hwtstamp_rx_ptp = ADI_MSP_PTP_L2 | ADI_MSP_PTP_L4;
+		config.rx_filter = HWTSTAMP_FILTER_PTP_V2_EVENT;
 		break;
 	default:
-		lp->hwtstamp_rx_en = true;
+		lp->hwtstamp_rx_ptp = ADI_MSP_PTP_L2 | ADI_MSP_PTP_L4;
 		config.rx_filter = HWTSTAMP_FILTER_ALL;
 		break;
 	}
+	lp->hwtstamp_rx_filter = config.rx_filter;
 
 	if (copy_to_user(ifr->ifr_data, &config, sizeof(config)))
 		return -EFAULT;
@@ -2547,8 +5194,7 @@ static int adi_msp_hwtstamp_get(struct net_device *dev, struct ifreq *ifr)
 
 	config.flags = 0;
 	config.tx_type = lp->hwtstamp_tx_en ? HWTSTAMP_TX_ON : HWTSTAMP_TX_OFF;
-	config.rx_filter = lp->hwtstamp_rx_en ?
-				HWTSTAMP_FILTER_ALL : HWTSTAMP_FILTER_NONE;
+	config.rx_filter = lp->hwtstamp_rx_filter;
 
 	if (copy_to_user(ifr->ifr_data, &config, sizeof(config)))
 		return -EFAULT;
@@ -2576,30 +5222,406 @@ static int adi_msp_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
 	}
 }
 
+static int adi_msp_xdp_setup(struct net_device *dev, struct bpf_prog *prog,
+			     struct netlink_ext_ack *extack)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct bpf_prog *old_prog;
+
+	if (prog && dev->mtu > XDP_MAX_MTU) {
+		NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+		return -EOPNOTSUPP;
+	}
+
+	/* Rx NAPI reads the program once for each poll. The old one is
+	 * freed after RCU grace period.
+	 */
+	old_prog = xchg(&lp->xdp_prog, prog);
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+/* Bind AF_XDP zero-copy socket with POOL to queue QID, or unbind it if POOL
+ * is NULL. There is only one Rx queue, and XDP frames are sent on non-PTP
+ * Tx queue, so the socket can only be bound to queue 0. Rx ring is refilled
+ * from the pool and Tx status NAPI sends from it once dev is reopened.
+ */
+static int adi_msp_xsk_pool_setup(struct net_device *dev,
+				  struct xsk_buff_pool *pool, u16 qid)
+{
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct xsk_buff_pool *old_pool = lp->xsk_pool;
+	bool running = netif_running(dev);
+	int ret;
+
+	if (qid != 0)
+		return -EINVAL;
+
+	if (pool) {
+		if (old_pool)
+			return -EBUSY;
+		/* Frames in more than one work unit are never zero-copy */
+		if (dev->mtu > XDP_MAX_MTU)
+			return -EOPNOTSUPP;
+		if (xsk_pool_get_rx_frame_size(pool) < RX_WU_LEN)
+			return -EINVAL;
+
+		ret = xsk_pool_dma_map(pool, lp->dmadev, 0);
+		if (ret)
+			return ret;
+	} else if (!old_pool) {
+		return 0;
+	}
+
+	if (running) {
+		netif_tx_disable(dev);
+		adi_msp_close(dev);
+	}
+
+	lp->xsk_pool = pool;
+
+	ret = running ? adi_msp_open(dev) : 0;
+	if (ret) {
+		/* Unbinding goes on anyway, the socket is going away */
+		if (pool) {
+			lp->xsk_pool = old_pool;
+			xsk_pool_dma_unmap(pool, 0);
+		}
+		adi_msp_reopen(dev);
+	}
+
+	if (!lp->xsk_pool && old_pool)
+		xsk_pool_dma_unmap(old_pool, 0);
+
+	return ret;
+}
+
+static int adi_msp_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return adi_msp_xdp_setup(dev, bpf->prog, bpf->extack);
+	case XDP_SETUP_XSK_POOL:
+		return adi_msp_xsk_pool_setup(dev, bpf->xsk.pool,
+					      bpf->xsk.queue_id);
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops adi_msp_netdev_ops = {
 	.ndo_open		= adi_msp_open,
 	.ndo_stop		= adi_msp_close,
 	.ndo_start_xmit		= adi_msp_send_packet,
+	.ndo_select_queue	= adi_msp_select_queue,
 	.ndo_tx_timeout		= adi_msp_tx_timeout,
 	.ndo_validate_addr	= eth_validate_addr,
+	.ndo_change_mtu		= adi_msp_change_mtu,
 	.ndo_get_stats64	= adi_msp_get_stats64,
 	.ndo_do_ioctl		= adi_msp_ioctl,
+	.ndo_bpf		= adi_msp_bpf,
+	.ndo_xdp_xmit		= adi_msp_xdp_xmit,
+	.ndo_xsk_wakeup		= adi_msp_xsk_wakeup,
+};
+
+/* Netdev of the other E-tile port. MSP, its DMAs and NAPIs are owned by
+ * lp->dev. This one only has its own Tx queues, MTU and stats.
+ */
+
+static int adi_msp_port_open(struct net_device *dev)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	/* Otherwise started when lp->dev is opened */
+	if (netif_running(pp->lp->dev))
+		adi_msp_port_start(dev);
+
+	return 0;
+}
+
+static int adi_msp_port_close(struct net_device *dev)
+{
+	adi_msp_port_stop(dev);
+
+	return 0;
+}
+
+static int adi_msp_port_send_packet(struct sk_buff *skb, struct net_device *dev)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	return adi_msp_xmit(pp->lp, skb, dev, pp->port);
+}
+
+/* Both ports share Tx rings, so all of MSP Tx is reset */
+static void adi_msp_port_tx_timeout(struct net_device *dev,
+				    unsigned int txqueue)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	MSP_ERR("%s: Tx queue %u timed out\n", dev->name, txqueue);
+
+	atomic64_inc(&pp->lp->tx_errors[pp->port]);
+	adi_msp_schedule_tx_reset(pp->lp);
+}
+
+/* lp->dev is restarted only if MIN/MAX frame size has to change */
+static int adi_msp_port_change_mtu(struct net_device *dev, int new_mtu)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+	struct adi_msp_private *lp = pp->lp;
+	int old_frame_mtu = adi_msp_frame_mtu(lp);
+	int old_mtu = dev->mtu;
+	int ret;
+
+	MSP_DBG("%s: change MTU from %d to %d\n", dev->name, dev->mtu, new_mtu);
+
+	dev->mtu = new_mtu;
+
+	if (!netif_running(lp->dev) || adi_msp_frame_mtu(lp) == old_frame_mtu)
+		return 0;
+
+	netif_tx_disable(lp->dev);
+	adi_msp_close(lp->dev);
+
+	ret = adi_msp_open(lp->dev);
+	if (ret) {
+		dev->mtu = old_mtu;
+		adi_msp_reopen(lp->dev);
+	}
+
+	return ret;
+}
+
+static void adi_msp_port_get_stats64(struct net_device *dev,
+				     struct rtnl_link_stats64 *stats)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+	struct adi_msp_nl_stats nl;
+
+	adi_msp_get_nl_stats(pp->lp, pp->port, &nl);
+	adi_msp_fill_stats64(&nl, stats);
+}
+
+/* Hardware timestamping is configured for both ports at once */
+static int adi_msp_port_ioctl(struct net_device *dev, struct ifreq *ifr,
+			      int cmd)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	return adi_msp_ioctl(pp->lp->dev, ifr, cmd);
+}
+
+static const struct net_device_ops adi_msp_port_netdev_ops = {
+	.ndo_open		= adi_msp_port_open,
+	.ndo_stop		= adi_msp_port_close,
+	.ndo_start_xmit		= adi_msp_port_send_packet,
+	.ndo_select_queue	= adi_msp_select_queue,
+	.ndo_tx_timeout		= adi_msp_port_tx_timeout,
+	.ndo_validate_addr	= eth_validate_addr,
+	.ndo_change_mtu		= adi_msp_port_change_mtu,
+	.ndo_get_stats64	= adi_msp_port_get_stats64,
+	.ndo_do_ioctl		= adi_msp_port_ioctl,
+};
+
+static void adi_msp_port_get_drvinfo(struct net_device *dev,
+				     struct ethtool_drvinfo *info)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	strlcpy(info->driver, DRV_NAME, sizeof(info->driver));
+	strlcpy(info->version, DRV_VERSION, sizeof(info->version));
+	strlcpy(info->bus_info, pp->lp->dev->name, sizeof(info->bus_info));
+}
+
+static int adi_msp_port_get_ts_info(struct net_device *dev,
+				    struct ethtool_ts_info *info)
+{
+	struct adi_msp_port *pp = netdev_priv(dev);
+
+	return adi_msp_get_ts_info(pp->lp->dev, info);
+}
+
+static const struct ethtool_ops adi_msp_port_ethtool_ops = {
+	.get_drvinfo		= adi_msp_port_get_drvinfo,
+	.get_link		= ethtool_op_get_link,
+	.get_ts_info		= adi_msp_port_get_ts_info,
 };
 
 #define TX_TIMEOUT	(6000 * HZ / 1000)
 
+/* Return the CPU given by the property, or -1 if there is none */
+static int adi_msp_get_irq_cpu(struct net_device *dev, struct device_node *np,
+			       const char *prop)
+{
+	u32 cpu;
+
+	if (of_property_read_u32(np, prop, &cpu) < 0)
+		return -1;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu)) {
+		MSP_ERR("%s: bad %s value %u, ignored\n", dev->name, prop, cpu);
+		return -1;
+	}
+
+	return cpu;
+}
+
+static void adi_msp_lat_show(struct seq_file *m, const char *name,
+			     const struct adi_msp_lat_hist *h)
+{
+	int b;
+
+	seq_printf(m, "%s: count %llu avg %llu ns max %llu ns\n", name,
+		   h->count, h->count ? div64_u64(h->sum_ns, h->count) : 0,
+		   h->max_ns);
+
+	for (b = 0; b < ADI_MSP_LAT_BUCKETS; b++) {
+		if (!h->bucket[b])
+			continue;
+
+		if (b == ADI_MSP_LAT_BUCKETS - 1)
+			seq_printf(m, "  [%llu, inf) ns: %llu\n",
+				   1ULL << b, h->bucket[b]);
+		else
+			seq_printf(m, "  [%llu, %llu) ns: %llu\n",
+				   b ? 1ULL << b : 0, 2ULL << b, h->bucket[b]);
+	}
+}
+
+/* Histograms a NAPI has not cleared yet are shown empty */
+static int adi_msp_latency_show(struct seq_file *m, void *v)
+{
+	static const struct adi_msp_lat_hist empty;
+	struct adi_msp_private *lp = m->private;
+	u32 clear_gen = READ_ONCE(lp->lat_clear_gen);
+	bool tx_cleared = READ_ONCE(lp->tx_lat_gen) == clear_gen;
+	bool rx_cleared = READ_ONCE(lp->rx_lat_gen) == clear_gen;
+	int i;
+
+	for (i = 0; i < ADI_MSP_TX_LAT_NUM; i++)
+		adi_msp_lat_show(m, adi_msp_tx_lat_names[i],
+				 tx_cleared ? &lp->tx_lat[i] : &empty);
+	adi_msp_lat_show(m, "rx_irq_to_receive",
+			 rx_cleared ? &lp->rx_lat : &empty);
+
+	return 0;
+}
+
+static int adi_msp_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, adi_msp_latency_show, inode->i_private);
+}
+
+/* Any write clears the histograms. NAPIs may be adding to them, so they
+ * are cleared by each NAPI before its next sample, see adi_msp_lat_sync().
+ */
+static ssize_t adi_msp_latency_write(struct file *file,
+				     const char __user *buf, size_t count,
+				     loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct adi_msp_private *lp = m->private;
+
+	WRITE_ONCE(lp->lat_clear_gen, lp->lat_clear_gen + 1);
+
+	return count;
+}
+
+static const struct file_operations adi_msp_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = adi_msp_latency_open,
+	.read = seq_read,
+	.write = adi_msp_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Latency histograms are in <debugfs>/adi-msp/<device>/latency. They are
+ * only filled while latency_stats module parameter is set. Tx timestamps
+ * are kept in lp->tx_time[], which is only allocated with the rings, so
+ * Tx latencies also need it set when the interface is opened.
+ */
+static void adi_msp_debugfs_init(struct platform_device *pdev,
+				 struct adi_msp_private *lp)
+{
+	lp->debugfs_dir = debugfs_create_dir(dev_name(&pdev->dev),
+					     adi_msp_debugfs_root);
+	debugfs_create_file("latency", 0600, lp->debugfs_dir, lp,
+			    &adi_msp_latency_fops);
+}
+
+/* Register the netdev of the other port of lp */
+static int adi_msp_probe_port(struct platform_device *pdev,
+			      struct adi_msp_private *lp)
+{
+	struct adi_msp_port *pp;
+	struct net_device *dev;
+	int ret;
+
+	dev = devm_alloc_etherdev_mqs(&pdev->dev, sizeof(struct adi_msp_port),
+				      ADI_MSP_NUM_TXQS, 1);
+	if (!dev)
+		return -ENOMEM;
+
+	SET_NETDEV_DEV(dev, &pdev->dev);
+	pp = netdev_priv(dev);
+	pp->lp = lp;
+	pp->dev = dev;
+	pp->port = lp->port ^ 1;
+
+	eth_hw_addr_random(dev);
+
+	dev->needed_headroom = TX_WU_HEADER_LEN;
+	dev->hw_features |= NETIF_F_SG;
+	dev->features |= NETIF_F_SG;
+	dev->max_mtu = MAX_MTU;
+	dev->irq = lp->rx_dmadone_irq;
+
+	dev->netdev_ops = &adi_msp_port_netdev_ops;
+	dev->ethtool_ops = &adi_msp_port_ethtool_ops;
+	dev->watchdog_timeo = TX_TIMEOUT;
+
+	/* See adi_msp_port_start() */
+	netif_carrier_off(dev);
+	netif_tx_stop_all_queues(dev);
+
+	ret = register_netdev(dev);
+	if (ret < 0) {
+		MSP_ERR("%s: cannot register net device of port %u: %d\n",
+			lp->dev->name, pp->port, ret);
+		return ret;
+	}
+
+	/* Rx frames of the port went to lp->dev until now */
+	lp->port_dev[pp->port] = dev;
+
+	MSP_INFO("%s: port %u of %s\n", dev->name, pp->port, lp->dev->name);
+	return 0;
+}
+
 static int adi_msp_probe(struct platform_device *pdev)
 {
 	struct adi_msp_private *lp;
 	struct net_device *dev;
 	const char *etile_name, *oif_tx_name, *oif_rx_name;
 	bool has_ptp;
-	struct device_node *ptp_clk_node;
+	struct device_node *ptp_clk_node, *np;
 	struct platform_device *ptp_clk_dev;
 	struct adi_phc *phc;
+	struct resource *res;
 	void __iomem *p;
-	u32 eth;
-	int ret;
+	u32 eth, port;
+	int i, ret;
+
+	/* Hot groups of struct adi_msp_private must not share cache lines */
+	BUILD_BUG_ON(ADI_MSP_CACHELINE_OFFSET(tx_next_use));
+	BUILD_BUG_ON(ADI_MSP_CACHELINE_OFFSET(tx_count));
+	BUILD_BUG_ON(ADI_MSP_CACHELINE_OFFSET(status_napi));
+	BUILD_BUG_ON(ADI_MSP_CACHELINE_OFFSET(rx_napi));
+	BUILD_BUG_ON(ADI_MSP_CACHELINE_OFFSET(rx_dmadone_irq));
 
 	MSP_DBG("Entering %s ...\n", __func__);
 
@@ -2639,7 +5661,8 @@ static int adi_msp_probe(struct platform_device *pdev)
 	}
 
 ptp_check_done:
-	dev = devm_alloc_etherdev(&pdev->dev, sizeof(struct adi_msp_private));
+	dev = devm_alloc_etherdev_mqs(&pdev->dev, sizeof(struct adi_msp_private),
+				      ADI_MSP_NUM_TXQS, 1);
 	if (!dev)
 		return -ENOMEM;
 
@@ -2648,9 +5671,16 @@ ptp_check_done:
 
 	lp->has_ptp = has_ptp;
 	lp->hwtstamp_tx_en = has_ptp;
-	lp->hwtstamp_rx_en = has_ptp;
+	if (has_ptp) {
+		lp->hwtstamp_rx_filter = HWTSTAMP_FILTER_ALL;
+		lp->hwtstamp_rx_ptp = ADI_MSP_PTP_L2 | ADI_MSP_PTP_L4;
+	} else {
+		lp->hwtstamp_rx_filter = HWTSTAMP_FILTER_NONE;
+	}
 	lp->ptp_clk = lp->has_ptp ? phc->ptp_clk : NULL;
 
+	lp->rx_copybreak = RX_COPYBREAK_DEFAULT;
+
 	ret = platform_get_irq_byname(pdev, "rx_dmadone_irq");
 	if (ret < 0)
 		return ret;
@@ -2689,6 +5719,22 @@ ptp_check_done:
 		return -EINVAL;
 	}
 
+	np = pdev->dev.of_node;
+	lp->rx_irq_cpu = adi_msp_get_irq_cpu(dev, np, "adi,rx-dma-irq-cpu");
+	lp->tx_irq_cpu = adi_msp_get_irq_cpu(dev, np, "adi,tx-dma-irq-cpu");
+	lp->status_irq_cpu = adi_msp_get_irq_cpu(dev, np,
+						 "adi,status-dma-irq-cpu");
+
+	/* Port 0 unless told otherwise */
+	port = 0;
+	of_property_read_u32(np, "adi,port", &port);
+	if (port >= ADI_MSP_NUM_PORTS) {
+		MSP_ERR("%s: bad adi,port value %u\n", dev->name, port);
+		return -EINVAL;
+	}
+	lp->port = port;
+	lp->port_dev[port] = dev;
+
 	etile_name = (eth == 0) ? "etile0" : "etile1";
 	p = devm_platform_ioremap_resource_byname(pdev, etile_name);
 	if (IS_ERR(p)) {
@@ -2730,6 +5776,19 @@ ptp_check_done:
 	}
 	lp->axi_palau_gpio_msp_ctrl = p;
 
+	/* Optional. Without it Tx is recovered without resetting MSP Tx */
+	res = platform_get_resource_byname(pdev, IORESOURCE_MEM, "rst_ctrl");
+	if (res) {
+		p = devm_ioremap_resource(&pdev->dev, res);
+		if (IS_ERR(p)) {
+			MSP_ERR("%s: cannot remap MSP reset control register\n",
+				dev->name);
+			return PTR_ERR(p);
+		}
+		lp->rst_ctrl = p;
+		lp->rst_ctrl_tx = (eth == 0) ? MSP_RST_CTRL_TX0 : MSP_RST_CTRL_TX1;
+	}
+
 	/* MAC address should have been set. But it is not. So we set it. */
 
 	/*
@@ -2798,42 +5857,28 @@ ptp_check_done:
 	}
 	lp->dde_tester_regs = p;
 
-	lp->td_ring = dmam_alloc_coherent(&pdev->dev, ADI_MSP_TD_RING_SIZE,
-					  &lp->td_dma, GFP_KERNEL);
-	if (!lp->td_ring) {
-		MSP_ERR("%s: cannot alloc Tx ring\n", dev->name);
-		return -ENOMEM;
-	}
-
-	lp->rd_ring = dmam_alloc_coherent(&pdev->dev, ADI_MSP_RD_RING_SIZE,
-					  &lp->rd_dma, GFP_KERNEL);
-	if (!lp->rd_ring) {
-		MSP_ERR("%s: cannot alloc Rx ring\n", dev->name);
-		return -ENOMEM;
-	}
-
-	lp->sd_ring = dmam_alloc_coherent(&pdev->dev, ADI_MSP_SD_RING_SIZE,
-					  &lp->sd_dma, GFP_KERNEL);
-	if (!lp->sd_ring) {
-		MSP_ERR("%s: cannot alloc Status ring\n", dev->name);
-		return -ENOMEM;
-	}
+	lp->num_rds = ADI_MSP_DEF_NUM_RDS;
+	lp->num_tds = ADI_MSP_DEF_NUM_TDS;
 
-	lp->status_wu = dmam_alloc_coherent(&pdev->dev,
-					    ADI_MSP_NUM_SDS * STATUS_WU_BUF_SIZE,
-					    &lp->status_wu_dma, GFP_KERNEL);
-	if (!lp->status_wu) {
-		MSP_ERR("%s: cannot alloc buffer for Tx status work units\n",
-			dev->name);
+	lp->tx_pad = dmam_alloc_coherent(&pdev->dev, TX_PAD_BUF_SIZE,
+					 &lp->tx_pad_dma, GFP_KERNEL);
+	if (!lp->tx_pad) {
+		MSP_ERR("%s: cannot alloc buffer for Tx pads\n", dev->name);
 		return -ENOMEM;
 	}
-	memset(lp->status_wu, 0, ADI_MSP_NUM_SDS * STATUS_WU_BUF_SIZE);
+	memset(lp->tx_pad, 0, TX_PAD_BUF_SIZE);
 
 	spin_lock_init(&lp->lock);
 
 	/* Each packet needs to have a Tx work unit header */
 	dev->needed_headroom = TX_WU_HEADER_LEN;
 
+	/* Page fragments are sent with chained Tx descriptors */
+	dev->hw_features |= NETIF_F_SG;
+	dev->features |= NETIF_F_SG;
+
+	dev->max_mtu = MAX_MTU;
+
 	/* just use the rx dma done irq */
 	dev->irq = lp->rx_dmadone_irq;
 	lp->dev = dev;
@@ -2843,27 +5888,81 @@ ptp_check_done:
 	dev->ethtool_ops = &netdev_ethtool_ops;
 	dev->watchdog_timeo = TX_TIMEOUT;
 
-	netif_napi_add(dev, &lp->rx_napi, adi_msp_rx_poll, NAPI_POLL_WEIGHT);
+	netif_napi_add(dev, &lp->rx_napi, adi_msp_rx_poll,
+		       clamp_t(unsigned int, rx_napi_weight, 1,
+			       NAPI_POLL_WEIGHT));
 	netif_napi_add(dev, &lp->status_napi, adi_msp_status_poll,
-		       NAPI_POLL_WEIGHT);
+		       clamp_t(unsigned int, status_napi_weight, 1,
+			       NAPI_POLL_WEIGHT));
+
+	hrtimer_init(&lp->rx_coal_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL_PINNED);
+	lp->rx_coal_timer.function = adi_msp_rx_coal_timer;
+	hrtimer_init(&lp->status_coal_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL_PINNED);
+	lp->status_coal_timer.function = adi_msp_status_coal_timer;
+
+	INIT_WORK(&lp->rx_dim.work, adi_msp_rx_dim_work);
+	lp->rx_dim.mode = DIM_CQ_PERIOD_MODE_START_FROM_EQE;
+
+	INIT_WORK(&lp->tx_reset_work, adi_msp_tx_reset_work);
+
+	for (i = 0; i < ADI_MSP_NUM_PORTS; i++) {
+		u64_stats_init(&lp->rx_stats[i].syncp);
+		u64_stats_init(&lp->tx_stats[i].syncp);
+	}
+
+	mutex_init(&lp->hw_stats_mutex);
+	spin_lock_init(&lp->hw_stats_lock);
+	INIT_DELAYED_WORK(&lp->hw_stats_work, adi_msp_hw_stats_work);
+	lp->hw_stats_usecs = ADI_MSP_DEF_STATS_USECS;
 
 	platform_set_drvdata(pdev, dev);
 
+	/* Hardware counters are collected whether the interface is up or
+	 * not, so 32-bit ones never wrap unnoticed
+	 */
+	schedule_delayed_work(&lp->hw_stats_work, 0);
+
 	ret = register_netdev(dev);
 	if (ret < 0) {
 		MSP_ERR("%s: cannot register net device: %d\n", dev->name, ret);
+		cancel_delayed_work_sync(&lp->hw_stats_work);
 		return ret;
 	}
 
 	MSP_INFO("%s: " DRV_NAME "-" DRV_VERSION "\n", dev->name);
-	return ret;
+
+	if (of_property_read_bool(np, "adi,dual-port")) {
+		ret = adi_msp_probe_port(pdev, lp);
+		if (ret < 0) {
+			unregister_netdev(dev);
+			cancel_delayed_work_sync(&lp->hw_stats_work);
+			return ret;
+		}
+	}
+
+	adi_msp_debugfs_init(pdev, lp);
+
+	return 0;
 }
 
 static int adi_msp_remove(struct platform_device *pdev)
 {
 	struct net_device *dev = platform_get_drvdata(pdev);
+	struct adi_msp_private *lp = netdev_priv(dev);
+	struct net_device *other = adi_msp_other_dev(lp);
 
+	debugfs_remove_recursive(lp->debugfs_dir);
+
+	/* Closing lp->dev stops the other port and frees its frames in
+	 * flight, so it goes first
+	 */
 	unregister_netdev(dev);
+	cancel_work_sync(&lp->tx_reset_work);
+	if (other)
+		unregister_netdev(other);
+	cancel_delayed_work_sync(&lp->hw_stats_work);
 
 	return 0;
 }
@@ -2885,7 +5984,26 @@ static struct platform_driver adi_msp_driver = {
 	.remove = adi_msp_remove,
 };
 
-module_platform_driver(adi_msp_driver);
+static int __init adi_msp_init(void)
+{
+	int ret;
+
+	adi_msp_debugfs_root = debugfs_create_dir(DRV_NAME, NULL);
+
+	ret = platform_driver_register(&adi_msp_driver);
+	if (ret)
+		debugfs_remove_recursive(adi_msp_debugfs_root);
+
+	return ret;
+}
+module_init(adi_msp_init);
+
+static void __exit adi_msp_exit(void)
+{
+	platform_driver_unregister(&adi_msp_driver);
+	debugfs_remove_recursive(adi_msp_debugfs_root);
+}
+module_exit(adi_msp_exit);
 
 MODULE_AUTHOR("Jie Zhang <jie.zhang@analog.com>");
 MODULE_DESCRIPTION("Analog Devices MS Plane Ethernet driver");